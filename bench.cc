@@ -0,0 +1,264 @@
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <tuple>
+
+#include "mpack.h"
+
+using namespace msgpack;
+
+// keeps the optimizer from throwing away results
+template <class T>
+void keep(const T &value) { asm volatile("" : : "g"(&value) : "memory"); }
+
+// ns per call of f, repeated until enough time has passed to be meaningful
+template <class F>
+double measure(F &&f) {
+  using clock = std::chrono::steady_clock;
+  size_t iterations = 1;
+  while (true) {
+    const auto start = clock::now();
+    for (size_t i = 0; i < iterations; i++) f();
+    const std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+    if (elapsed.count() > 2e8) return elapsed.count() / iterations;
+    iterations *= 2;
+  }
+}
+
+// --json prints one object per line instead, for tracking results across versions
+bool json = false;
+
+void report(const std::string &name, const double ns, const size_t bytes) {
+  if (json) std::printf("{\"name\": \"%s\", \"ns_per_op\": %.1f, \"bytes\": %zu, \"gb_per_s\": %.3f}\n", name.c_str(), ns, bytes, bytes / ns);
+  else std::printf("%-40s %12.1f ns/op %8.2f GB/s\n", name.c_str(), ns, bytes / ns);
+}
+
+// encode and decode of a whole vector of values
+template <class T>
+void bench_codec(const std::string &name, const std::vector<T> &values) {
+  const Buffer packed = pack(values);
+  report(name + " encode", measure([&] { keep(pack(values)); }), packed.size());
+  report(name + " decode", measure([&] { keep(unpack<std::vector<T>>(packed)); }), packed.size());
+}
+
+// the per-element path, i.e. what arrays cost without the bulk kernels
+template <class T>
+Buffer pack_elements(const std::vector<T> &values) {
+  Packer packer;
+  detail::pack_array_header(packer, values.size());
+  for (const T &value : values) pack_one(packer, value);
+  return packer.take();
+}
+
+template <class T>
+std::optional<std::vector<T>> unpack_elements(const Buffer &buffer) {
+  Unpacker unpacker(buffer);
+  const std::optional<size_t> size = detail::unpack_array_header(unpacker);
+  if (!size) return std::nullopt;
+  std::vector<T> values;
+  values.reserve(*size);
+  for (size_t i = 0; i < *size; i++) {
+    const std::optional<T> value = unpack_one<T>(unpacker);
+    if (!value) return std::nullopt;
+    values.push_back(*value);
+  }
+  return values;
+}
+
+struct vec3 {
+  float x;
+  std::string y;
+  uint8_t z;
+};
+
+define_pack(vec3) {
+  do_pack(value.x);
+  do_pack(value.y);
+  do_pack(value.z);
+}
+
+define_unpack(vec3) {
+  return vec3{
+    .x = do_unpack(float),
+    .y = do_unpack(std::string),
+    .z = do_unpack(uint8_t),
+  };
+}
+
+struct path {
+  std::string name;
+  std::vector<vec3> points;
+  std::map<std::string, int64_t> tags;
+};
+
+define_aggregate(path);
+
+// same fields, one through the fused aggregate codec and one field by field
+struct tick {
+  double price;
+  float size;
+  fixed_width<uint64_t> time;
+  fixed_width<int32_t> venue;
+};
+
+define_aggregate(tick);
+
+struct tick_by_field : tick {};
+
+define_pack(tick_by_field) {
+  do_pack(value.price);
+  do_pack(value.size);
+  do_pack(value.time);
+  do_pack(value.venue);
+}
+
+define_unpack(tick_by_field) {
+  tick_by_field value;
+  value.price = do_unpack(double);
+  value.size = do_unpack(float);
+  value.time = do_unpack(fixed_width<uint64_t>);
+  value.venue = do_unpack(fixed_width<int32_t>);
+  return value;
+}
+
+template <class T, class Wrap = std::vector<T>>
+void bench_array(const std::string &name, const std::vector<T> &values) {
+  const Wrap wrapped{values};
+  const Buffer packed = pack(wrapped);
+
+  report(name + " encode per-element", measure([&] { keep(pack_elements(values)); }), packed.size());
+  report(name + " decode per-element", measure([&] { keep(unpack_elements<T>(packed)); }), packed.size());
+  for (const detail::Kernels *kernels : detail::supported_kernels()) {
+    detail::kernels() = kernels;
+    report(name + " encode " + kernels->name, measure([&] { keep(pack(wrapped)); }), packed.size());
+    report(name + " decode " + kernels->name, measure([&] { keep(unpack<Wrap>(packed)); }), packed.size());
+  }
+  detail::kernels() = detail::supported_kernels().back();
+}
+
+// length uniform in [lo, hi]
+std::string random_string(std::mt19937_64 &rng, const size_t lo, const size_t hi) {
+  std::string s(lo + rng() % (hi - lo + 1), 0);
+  for (char &c : s) c = 'a' + rng() % 26;
+  return s;
+}
+
+int main(int argc, char **argv) {
+  json = argc > 1 && std::string(argv[1]) == "--json";
+  constexpr size_t n = 10000;
+  std::mt19937_64 rng(727);
+
+  std::vector<uint64_t> fixints(n), uint64s(n), mixed_uints(n);
+  for (uint64_t &u : fixints) u = rng() % 128;
+  for (uint64_t &u : uint64s) u = rng() | (uint64_t(1) << 63);
+  // every width from fixint to uint 64 about equally often
+  for (uint64_t &u : mixed_uints) u = rng() >> (rng() % 64);
+  std::vector<int64_t> mixed_ints(n);
+  for (int64_t &i : mixed_ints) i = static_cast<int64_t>(rng()) >> (rng() % 64);
+  bench_codec("uint fixint[10k]", fixints);
+  bench_codec("uint uint64[10k]", uint64s);
+  bench_codec("uint mixed[10k]", mixed_uints);
+  bench_codec("int mixed[10k]", mixed_ints);
+
+  std::vector<std::string> fixstrs(n), str8s(n), str16s(n / 10), str32s(8), mixed_strs(n);
+  for (std::string &s : fixstrs) s = random_string(rng, 0, 31);
+  for (std::string &s : str8s) s = random_string(rng, 32, 255);
+  for (std::string &s : str16s) s = random_string(rng, 256, 65535 / 16);
+  for (std::string &s : str32s) s = random_string(rng, 65536, 1 << 18);
+  for (std::string &s : mixed_strs) s = random_string(rng, 0, rng() % 2 ? 31 : 300);
+  bench_codec("str fixstr[10k]", fixstrs);
+  bench_codec("str str8[10k]", str8s);
+  bench_codec("str str16[1k]", str16s);
+  bench_codec("str str32[8]", str32s);
+  bench_codec("str mixed[10k]", mixed_strs);
+
+  for (const auto &[name, size, count] : {std::tuple{"bin 16b[10k]", 16, n}, {"bin 4kb[1k]", 4096, n / 10}, {"bin 1mb[8]", 1 << 20, 8}}) {
+    std::vector<std::vector<uint8_t>> bins(count, std::vector<uint8_t>(size));
+    for (auto &bin : bins) for (uint8_t &b : bin) b = rng();
+    bench_codec(name, bins);
+  }
+
+  // mostly recent times with sub-second parts (64-bit form), some whole seconds (32-bit)
+  std::vector<std::chrono::system_clock::time_point> times(n);
+  for (auto &t : times) t = std::chrono::system_clock::time_point(std::chrono::seconds(1'700'000'000 + rng() % 100'000'000)) + std::chrono::nanoseconds(rng() % 4 ? rng() % 1'000'000'000 : 0);
+  bench_codec("timestamp[10k]", times);
+
+  std::vector<vec3> vec3s(n);
+  for (vec3 &v : vec3s) v = {std::uniform_real_distribution<float>(-1e3, 1e3)(rng), random_string(rng, 0, 40), static_cast<uint8_t>(rng())};
+  bench_codec("vec3[10k]", vec3s);
+  std::vector<path> paths(n / 10);
+  for (path &p : paths) {
+    p.name = random_string(rng, 4, 20);
+    p.points.resize(rng() % 20);
+    for (vec3 &v : p.points) v = vec3s[rng() % n];
+    for (size_t i = rng() % 4; i > 0; i--) p.tags[random_string(rng, 1, 8)] = static_cast<int64_t>(rng()) >> (rng() % 64);
+  }
+  bench_codec("path[1k]", paths);
+
+  std::vector<float> floats(n);
+  for (float &f : floats) f = std::uniform_real_distribution<float>(-1e3, 1e3)(rng);
+  std::vector<double> doubles(n);
+  for (double &d : doubles) d = std::uniform_real_distribution<double>(-1e9, 1e9)(rng);
+  std::vector<int32_t> ints(n);
+  for (int32_t &i : ints) i = static_cast<int32_t>(rng());
+  std::vector<uint64_t> longs(n);
+  for (uint64_t &l : longs) l = rng();
+
+  bench_array("float[10k]", floats);
+  bench_array("double[10k]", doubles);
+  bench_array<int32_t, fixed_width<std::vector<int32_t>>>("fixed_width int32[10k]", ints);
+  bench_array<uint64_t, fixed_width<std::vector<uint64_t>>>("fixed_width uint64[10k]", longs);
+
+  std::vector<tick> ticks(n);
+  std::vector<tick_by_field> ticks_by_field(n);
+  for (size_t i = 0; i < n; i++) {
+    ticks[i] = {doubles[i], floats[i], {longs[i]}, {ints[i]}};
+    ticks_by_field[i] = {ticks[i]};
+  }
+  const Buffer packed_ticks = pack(ticks);
+  report("tick[10k] encode by field", measure([&] { keep(pack(ticks_by_field)); }), packed_ticks.size());
+  report("tick[10k] decode by field", measure([&] { keep(unpack<std::vector<tick_by_field>>(packed_ticks)); }), packed_ticks.size());
+  report("tick[10k] encode aggregate", measure([&] { keep(pack(ticks)); }), packed_ticks.size());
+  report("tick[10k] decode aggregate", measure([&] { keep(unpack<std::vector<tick>>(packed_ticks)); }), packed_ticks.size());
+
+  // one field changing in every record of a batch: rewritten in place, or the batch packed again
+  Buffer tick_batch = pack_batch(ticks, 1);
+  report("tick[10k] update time patch", measure([&] {
+    for (size_t i = 0; i < n; i++) patch<&tick::time>(std::span(tick_batch).subspan(i * layout<tick>::size), {longs[i] + 1});
+    keep(tick_batch);
+  }), tick_batch.size());
+  report("tick[10k] update time repack", measure([&] { keep(pack_batch(ticks, 1)); }), tick_batch.size());
+
+  std::vector<std::pair<std::string, std::vector<double>>> records(100 * n);
+  for (auto &[name, values] : records) {
+    name = std::string(8 + rng() % 24, 'r');
+    values.resize(rng() % 8);
+    for (double &d : values) d = std::uniform_real_distribution<double>(-1e9, 1e9)(rng);
+  }
+  const Buffer packed_records = pack_batch(records, 1);
+  for (const unsigned threads : {1u, std::thread::hardware_concurrency()}) {
+    const std::string name = "record[1m] batch x" + std::to_string(threads);
+    report(name + " encode", measure([&] { keep(pack_batch(records, threads)); }), packed_records.size());
+    report(name + " decode", measure([&] { keep(unpack_batch<std::pair<std::string, std::vector<double>>>(packed_records, threads)); }), packed_records.size());
+  }
+
+  // a few hundred symbols over and over
+  std::vector<std::string> symbols(300), symbol_stream(n);
+  for (std::string &s : symbols) s = random_string(rng, 4, 32);
+  for (std::string &s : symbol_stream) s = symbols[rng() % symbols.size()];
+  const Buffer packed_symbols = pack(symbol_stream);
+  Interner interner;
+  report("symbol[10k] decode string", measure([&] { keep(unpack<std::vector<std::string>>(packed_symbols)); }), packed_symbols.size());
+  report("symbol[10k] decode interned", measure([&] { keep(unpack<std::vector<interned>>(packed_symbols, interner)); }), packed_symbols.size());
+
+  std::vector<std::string> strings(n);
+  for (std::string &s : strings) s = std::string(16 + rng() % 48, 'x');
+  const Buffer packed_strings = pack(strings);
+  report("string[10k] decode heap", measure([&] { keep(unpack<std::vector<std::string>>(packed_strings)); }), packed_strings.size());
+  report("string[10k] decode arena", measure([&] {
+    Arena arena(packed_strings.size());
+    keep(unpack<std::pmr::vector<std::pmr::string>>(packed_strings, &arena));
+  }), packed_strings.size());
+}
@@ -1,93 +1,878 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bit>
+#include <chrono>
 #include <concepts>
 #include <cstdint>
-#include <functional>
+#include <cstring>
 #include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <span>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MPACK_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 namespace msgpack {
 
 using Buffer = std::vector<std::byte>;
 using BufferView = std::span<const std::byte>;
 
+enum class Errc { none, truncated, invalid, type_mismatch, out_of_range, duplicate_key, trailing_bytes, io };
+
+// why unpacking failed, and the offset of the byte it gave up at
+struct Error {
+  Errc code = Errc::none;
+  size_t offset = 0;
+
+  explicit operator bool() const { return code != Errc::none; }
+  bool operator==(const Error &) const = default;
+};
+
+// counters of what packing and unpacking get up to, for seeing where the bytes and the time go.
+// compiled in with MPACK_INSTRUMENT defined (MPACK_INSTRUMENT_TIMERS also times pack() and unpack()
+// calls), and otherwise every hook below is empty, so that nothing is counted or even stored
+namespace instrument {
+
+#if defined(MPACK_INSTRUMENT) || defined(MPACK_INSTRUMENT_TIMERS)
+inline constexpr bool enabled = true;
+#else
+inline constexpr bool enabled = false;
+#endif
+#ifdef MPACK_INSTRUMENT_TIMERS
+inline constexpr bool timed = true;
+#else
+inline constexpr bool timed = false;
+#endif
+
+// what values are counted as: their format, except that the sizes of array, map and ext, and true
+// and false, are one family each
+enum class Family : uint8_t {
+  fixint, negative_fixint, uint_8, uint_16, uint_32, uint_64, int_8, int_16, int_32, int_64,
+  float_32, float_64, fixstr, str_8, str_16, str_32, bin_8, bin_16, bin_32, nil, bool_, array, map, ext,
+};
+
+inline constexpr size_t families = static_cast<size_t>(Family::ext) + 1;
+inline constexpr size_t errcs = static_cast<size_t>(Errc::io) + 1;
+
+// Count is std::atomic<uint64_t> for the counters a thread bumps, uint64_t for a snapshot of them
+template <class Count>
+struct Counters {
+  // values packed and unpacked, by family
+  std::array<Count, families> packed{};
+  std::array<Count, families> unpacked{};
+  // bytes a packer handed to its sink, and bytes an unpacker got through (again for a retry)
+  Count bytes_written{};
+  Count bytes_read{};
+  // bytes a header-only walk (skip(), and so View, Cursor, split() and StreamUnpacker) got through
+  Count bytes_skipped{};
+  // times a packer's growable buffer had to move to a bigger allocation
+  Count reallocations{};
+  // strings, bins, arrays and map entries a decoder had to allocate room for
+  Count allocations{};
+  // unpacks that failed, by reason, and by where: failure_offsets[i] counts offsets of i bits
+  std::array<Count, errcs> failures{};
+  std::array<Count, 65> failure_offsets{};
+  // top-level pack() and unpack() calls, and the nanoseconds spent in them (MPACK_INSTRUMENT_TIMERS)
+  Count pack_calls{};
+  Count pack_ns{};
+  Count unpack_calls{};
+  Count unpack_ns{};
+
+  uint64_t packed_as(const Family family) const { return packed[static_cast<size_t>(family)]; }
+  uint64_t unpacked_as(const Family family) const { return unpacked[static_cast<size_t>(family)]; }
+  uint64_t failed_with(const Errc code) const { return failures[static_cast<size_t>(code)]; }
+
+  // f(a, b) for every counter a of this and the same one b of other
+  template <class Other, class F>
+  void each(Other &other, F &&f) {
+    const auto both = [&](auto &a, auto &b) {
+      if constexpr (requires { a.size(); }) for (size_t i = 0; i < a.size(); i++) f(a[i], b[i]);
+      else f(a, b);
+    };
+    both(packed, other.packed);
+    both(unpacked, other.unpacked);
+    both(bytes_written, other.bytes_written);
+    both(bytes_read, other.bytes_read);
+    both(bytes_skipped, other.bytes_skipped);
+    both(reallocations, other.reallocations);
+    both(allocations, other.allocations);
+    both(failures, other.failures);
+    both(failure_offsets, other.failure_offsets);
+    both(pack_calls, other.pack_calls);
+    both(pack_ns, other.pack_ns);
+    both(unpack_calls, other.unpack_calls);
+    both(unpack_ns, other.unpack_ns);
+  }
+};
+
+using Snapshot = Counters<uint64_t>;
+
+namespace detail {
+
+using Local = Counters<std::atomic<uint64_t>>;
+
+// the counters of every thread that has counted anything, plus what the ones that are gone left
+struct Registry {
+  std::mutex mutex;
+  std::vector<Local *> threads;
+  Snapshot retired;
+};
+
+inline Registry &registry() {
+  static Registry registry;
+  return registry;
+}
+
+// a thread's own counters. only it writes to them, so a bump is a plain load and store, atomic
+// just so that a snapshot can read them meanwhile
+struct Registration {
+  Local counters;
+
+  Registration() {
+    const std::lock_guard lock(registry().mutex);
+    registry().threads.push_back(&counters);
+  }
+
+  ~Registration() {
+    const std::lock_guard lock(registry().mutex);
+    registry().retired.each(counters, [](uint64_t &sum, const std::atomic<uint64_t> &count) { sum += count.load(std::memory_order_relaxed); });
+    std::erase(registry().threads, &counters);
+  }
+};
+
+inline Local &local() {
+  thread_local Registration registration;
+  return registration.counters;
+}
+
+inline void bump(std::atomic<uint64_t> &count, const uint64_t n = 1) {
+  count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+}
+
+// the counters of all threads added up, those that have exited included. all zero unless enabled
+inline Snapshot snapshot() {
+  Snapshot sum;
+  if constexpr (enabled) {
+    const std::lock_guard lock(detail::registry().mutex);
+    sum = detail::registry().retired;
+    for (detail::Local *counters : detail::registry().threads)
+      sum.each(*counters, [](uint64_t &sum, const std::atomic<uint64_t> &count) { sum += count.load(std::memory_order_relaxed); });
+  }
+  return sum;
+}
+
+// zeroes every counter. what other threads count meanwhile may or may not survive
+inline void reset() {
+  if constexpr (enabled) {
+    const std::lock_guard lock(detail::registry().mutex);
+    detail::registry().retired = {};
+    for (detail::Local *counters : detail::registry().threads)
+      counters->each(*counters, [](std::atomic<uint64_t> &count, auto &) { count.store(0, std::memory_order_relaxed); });
+  }
+}
+
+}
+
+namespace detail {
+
+// the hooks. constexpr, and no-ops at compile time, so that they can go anywhere pack_static() goes
+
+constexpr void count_written(const size_t n) {
+  if constexpr (instrument::enabled) if (!std::is_constant_evaluated()) instrument::detail::bump(instrument::detail::local().bytes_written, n);
+}
+
+inline void count_read(const size_t n) {
+  if constexpr (instrument::enabled) instrument::detail::bump(instrument::detail::local().bytes_read, n);
+}
+
+inline void count_skipped(const size_t n) {
+  if constexpr (instrument::enabled) instrument::detail::bump(instrument::detail::local().bytes_skipped, n);
+}
+
+inline void count_reallocation() {
+  if constexpr (instrument::enabled) instrument::detail::bump(instrument::detail::local().reallocations);
+}
+
+inline void count_allocation(const size_t n = 1) {
+  if constexpr (instrument::enabled) instrument::detail::bump(instrument::detail::local().allocations, n);
+}
+
+inline void count_failure(const Error &error) {
+  if constexpr (instrument::enabled) {
+    instrument::detail::Local &counters = instrument::detail::local();
+    instrument::detail::bump(counters.failures[static_cast<size_t>(error.code)]);
+    instrument::detail::bump(counters.failure_offsets[std::bit_width(error.offset)]);
+  }
+}
+
+// adds the time until it goes away to the pack or unpack timer
+class ScopedTimer {
+public:
+  explicit ScopedTimer(const bool packing) {
+    if constexpr (instrument::timed) {
+      calls = packing ? &instrument::detail::local().pack_calls : &instrument::detail::local().unpack_calls;
+      ns = packing ? &instrument::detail::local().pack_ns : &instrument::detail::local().unpack_ns;
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  ~ScopedTimer() {
+    if constexpr (instrument::timed) {
+      instrument::detail::bump(*calls);
+      instrument::detail::bump(*ns, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+  }
+
+private:
+  std::atomic<uint64_t> *calls = nullptr;
+  std::atomic<uint64_t> *ns = nullptr;
+  std::chrono::steady_clock::time_point start;
+};
+
+}
+
+// a sink hands the packer windows of writable memory and is told how much of each one got used.
+// the packer only calls into its sink when the current window runs out, so the byte-by-byte path
+// never goes through a virtual call
+class Sink {
+public:
+  constexpr virtual ~Sink() = default;
+
+  // next window to write into, preferably at least `hint` bytes long. empty means out of space
+  virtual std::span<std::byte> acquire(size_t hint) = 0;
+
+  // the first `used` bytes of the current window have been written
+  virtual void release(size_t used) = 0;
+};
+
+// growable sink, appends to a Buffer. the buffer is grown to its whole capacity and only cut back
+// to what was written when the sink goes away (or on get() and take()), so that the bytes past the
+// end are zero-filled once per growth rather than again on every refill
+class VectorSink : public Sink {
+public:
+  constexpr VectorSink() : buffer(owned) {}
+  constexpr explicit VectorSink(Buffer &buffer) : buffer(buffer), used(buffer.size()) {}
+  VectorSink(const VectorSink &) = delete;
+  VectorSink &operator=(const VectorSink &) = delete;
+  // spelled out (not defaulted) so that gcc can destroy one at compile time
+  constexpr ~VectorSink() override { trim(); }
+
+  std::span<std::byte> acquire(size_t hint) override {
+    constexpr size_t min_size = 64;
+    if (buffer.size() - used < std::max<size_t>(hint, 1)) {
+      const size_t capacity = buffer.capacity();
+      buffer.reserve(std::max({used + hint, 2 * used, min_size}));
+      buffer.resize(buffer.capacity());
+      if (capacity && buffer.capacity() != capacity) detail::count_reallocation();
+    }
+    return std::span(buffer).subspan(used);
+  }
+
+  void release(size_t used) override { this->used += used; }
+
+  // buffer is only referred to, so cutting it back leaves the sink itself as it was
+  const Buffer &get() const { trim(); return buffer; }
+  Buffer take() { trim(); used = 0; return std::move(buffer); }
+
+private:
+  constexpr void trim() const { buffer.resize(used); }
+
+  Buffer owned;
+  Buffer &buffer;
+  size_t used = 0;
+};
+
+// caller-owned fixed span. whatever does not fit is dropped and reported through overflowed().
+// usable at compile time, see pack_static()
+class SpanSink : public Sink {
+public:
+  constexpr explicit SpanSink(std::span<std::byte> span) : span(span) {}
+  constexpr ~SpanSink() override {}
+
+  constexpr std::span<std::byte> acquire(size_t) override {
+    const std::span<std::byte> rest = span.subspan(used);
+    if (rest.empty()) overflowed_ = true;
+    return rest;
+  }
+
+  constexpr void release(size_t used) override { this->used += used; }
+
+  constexpr size_t size() const { return used; }
+  constexpr bool overflowed() const { return overflowed_; }
+  constexpr std::span<std::byte> written() const { return span.first(used); }
+
+private:
+  std::span<std::byte> span;
+  size_t used = 0;
+  bool overflowed_ = false;
+};
+
+// scatter-gather chain of caller-owned segments (e.g. the buffers behind an iovec array), filled
+// in order. segment i of the result is filled(i) for i < count(), ready to be handed to writev()
+class ScatterSink : public Sink {
+public:
+  explicit ScatterSink(std::span<const std::span<std::byte>> segments) : segments(segments) {}
+
+  std::span<std::byte> acquire(size_t) override {
+    for (; index < segments.size(); index++, used = 0) {
+      const std::span<std::byte> rest = segments[index].subspan(used);
+      if (!rest.empty()) return rest;
+    }
+    overflowed_ = true;
+    return {};
+  }
+
+  void release(size_t used) override { this->used += used; total += used; }
+
+  size_t size() const { return total; }
+  bool overflowed() const { return overflowed_; }
+  size_t count() const { return index + (used > 0); }
+  std::span<std::byte> filled(size_t i) const { return i < index ? segments[i] : segments[i].first(used); }
+
+private:
+  std::span<const std::span<std::byte>> segments;
+  size_t index = 0;
+  size_t used = 0;
+  size_t total = 0;
+  bool overflowed_ = false;
+};
+
+// one slot of a ring buffer: starts at `head` and may use up to `capacity` bytes (i.e. up to where
+// the reader is), wrapping around the end of the ring. a capacity bigger than the ring is rejected:
+// the slot then takes nothing, and packing into it fails
+class RingSink : public Sink {
+public:
+  RingSink(std::span<std::byte> ring, size_t head, size_t capacity)
+    : ring(ring), head(head), capacity(capacity <= ring.size() ? capacity : 0) {}
+
+  std::span<std::byte> acquire(size_t) override {
+    if (used == capacity) { overflowed_ = true; return {}; }
+    const size_t pos = (head + used) % ring.size();
+    return ring.subspan(pos, std::min(capacity - used, ring.size() - pos));
+  }
+
+  void release(size_t used) override { this->used += used; }
+
+  size_t size() const { return used; }
+  bool overflowed() const { return overflowed_; }
+  // where the next slot starts once this one is committed
+  size_t next_head() const { return (head + used) % ring.size(); }
+
+private:
+  std::span<std::byte> ring;
+  size_t head;
+  size_t capacity;
+  size_t used = 0;
+  bool overflowed_ = false;
+};
+
+// drops everything, for when only the packer's byte count matters
+class NullSink : public Sink {
+public:
+  std::span<std::byte> acquire(size_t) override { return {}; }
+  void release(size_t) override {}
+};
+
 class Packer {
 public:
-  void push(std::byte b) { buffer.push_back(b); }
+  constexpr Packer() : sink(&owned) {}
+  constexpr explicit Packer(Sink &sink) : sink(&sink) {}
+  Packer(const Packer &) = delete;
+  Packer &operator=(const Packer &) = delete;
+  constexpr ~Packer() { flush(); }
+
+  constexpr void push(std::byte b) {
+    if (cur == end) [[unlikely]] refill(1);
+    *cur++ = b;
+  }
 
   template <class T>
   requires (!std::is_same_v<T, std::byte>) &&
            requires(T b) { static_cast<std::byte>(b); }
-  void push(T b) { return push(static_cast<std::byte>(b)); }
+  constexpr void push(T b) { return push(static_cast<std::byte>(b)); }
+
+  constexpr void write(std::span<const std::byte> bytes) {
+    if (discarding) { base += bytes.size(); return; }
+    while (!bytes.empty()) {
+      if (cur == end) refill(bytes.size());
+      const size_t n = std::min<size_t>(bytes.size(), end - cur);
+      std::copy_n(bytes.data(), n, cur);
+      cur += n;
+      bytes = bytes.subspan(n);
+    }
+  }
+
+  // n contiguous writable bytes, or nullptr if the sink can't provide that many in one window.
+  // whatever part of them gets written must then be committed with advance()
+  constexpr std::byte *claim(size_t n) {
+    reserve(n);
+    return !discarding && static_cast<size_t>(end - cur) >= n ? cur : nullptr;
+  }
+
+  constexpr void advance(size_t n) { cur += n; }
+
+  // make sure the next `n` bytes land in one window, e.g. one allocation for a vector sink
+  constexpr void reserve(size_t n) {
+    if (static_cast<size_t>(end - cur) < n) refill(n);
+  }
+
+  // bytes packed so far, including any the sink had no room for
+  constexpr size_t size() const { return base + (cur - begin); }
+  constexpr bool overflowed() const { return discarding; }
+
+  // hand everything written so far over to the sink
+  constexpr void flush() {
+    if (!discarding && begin) {
+      sink->release(cur - begin);
+      detail::count_written(cur - begin);
+    }
+    base += cur - begin;
+    begin = cur = end = nullptr;
+  }
+
+  // only meaningful for the default (owned) sink. const, since handing the window over doesn't
+  // change what was packed; a packer with a window open was written to, so isn't const itself
+  const Buffer &get() const {
+    if (begin) const_cast<Packer *>(this)->flush();
+    return owned.get();
+  }
+  Buffer take() { flush(); return owned.take(); }
+
+private:
+  constexpr void refill(size_t hint) {
+    flush();
+    if (!discarding) {
+      const std::span<std::byte> window = sink->acquire(hint);
+      if (!window.empty()) {
+        begin = cur = window.data();
+        end = begin + window.size();
+        return;
+      }
+      discarding = true;
+    }
+    // out of space: keep counting but throw the bytes away
+    begin = cur = scratch.data();
+    end = begin + scratch.size();
+  }
+
+  VectorSink owned;
+  Sink *sink;
+  std::byte *begin = nullptr;
+  std::byte *cur = nullptr;
+  std::byte *end = nullptr;
+  size_t base = 0;
+  bool discarding = false;
+  std::array<std::byte, 64> scratch;
+};
+
+// a string stored once by an Interner. handles from the same interner compare by id. one the
+// interner had no room for has id none and views the buffer it was unpacked from instead
+struct interned {
+  static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+  uint32_t id = none;
+  std::string_view view;
+
+  bool operator==(const interned &other) const { return id != none && other.id != none ? id == other.id : view == other.view; }
+  operator std::string_view() const { return view; }
+};
+
+namespace detail {
+
+// cheap hash for short strings: a word at a time, the last one overlapping the one before rather
+// than copied in byte by byte
+inline uint64_t hash_bytes(const std::string_view s) {
+  constexpr uint64_t k = 0xff51afd7ed558ccd;
+  const size_t n = s.size();
+  uint64_t h = 0x9e3779b97f4a7c15 ^ n;
+  const auto mix = [&](const uint64_t word) {
+    h = (h ^ word) * k;
+    h ^= h >> 32;
+  };
+  const auto load = [&]<class T>(const size_t at, T word) -> uint64_t {
+    std::memcpy(&word, s.data() + at, sizeof(T));
+    return word;
+  };
+  if (n >= 8) {
+    for (size_t i = 0; i + 8 < n; i += 8) mix(load(i, uint64_t{}));
+    mix(load(n - 8, uint64_t{}));
+  } else if (n >= 4) {
+    mix(load(0, uint32_t{}) << 32 | load(n - 4, uint32_t{}));
+  } else if (n > 0) {
+    mix(load(0, uint8_t{}) << 16 | load(n / 2, uint8_t{}) << 8 | load(n - 1, uint8_t{}));
+  }
+  return h ^ h >> 29;
+}
+
+}
+
+// bounded table of strings that keep coming back (symbols, tags, field names), for unpacking them
+// as interned rather than allocating a std::string each time. once it holds capacity strings, new
+// ones are no longer added, and strings longer than max_length never are
+class Interner {
+public:
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  explicit Interner(const size_t capacity = 4096, const size_t max_length = 64)
+    : capacity(std::min<size_t>(capacity, interned::none)), max_length(max_length),
+      slots(std::bit_ceil(2 * this->capacity + 1)) {}
+
+  interned intern(const std::string_view s) {
+    if (s.size() > max_length) {
+      stats_.misses++;
+      return {interned::none, s};
+    }
+    // open addressing, at most half full. the high half of the hash is kept in the slot so that
+    // probing past other strings rarely has to look at them
+    const uint64_t hash = detail::hash_bytes(s);
+    const uint32_t tag = hash >> 32;
+    const size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    for (; slots[i].id != interned::none; i = (i + 1) & mask) {
+      const Slot slot = slots[i];
+      if (slot.tag == tag && strings[slot.id] == s) {
+        stats_.hits++;
+        return {slot.id, strings[slot.id]};
+      }
+    }
+    stats_.misses++;
+    if (strings.size() == capacity) return {interned::none, s};
+
+    char *copy = static_cast<char *>(storage.allocate(std::max<size_t>(s.size(), 1), 1));
+    std::copy(s.begin(), s.end(), copy);
+    slots[i] = {static_cast<uint32_t>(strings.size()), tag};
+    strings.emplace_back(copy, s.size());
+    return {slots[i].id, strings.back()};
+  }
 
-  const Buffer &get() const { return buffer; }
+  std::string_view get(const uint32_t id) const { return strings[id]; }
+  size_t size() const { return strings.size(); }
+  const Stats &stats() const { return stats_; }
 
 private:
-  Buffer buffer;
+  struct Slot {
+    uint32_t id = interned::none;
+    uint32_t tag = 0;
+  };
+
+  size_t capacity;
+  size_t max_length;
+  std::vector<Slot> slots;
+  std::vector<std::string_view> strings;
+  std::pmr::monotonic_buffer_resource storage;
+  Stats stats_;
 };
 
-class Unpacker {
+namespace policy {
+// every read is bounds checked
+struct checked { static constexpr bool bounds_checked = true; };
+// only format bytes are, for buffers that passed validate(). that makes the structure trustworthy,
+// so lengths can be taken at face value; types are still checked
+struct trusted { static constexpr bool bounds_checked = false; };
+}
+
+template <class Policy>
+class BasicUnpacker {
 public:
-  Unpacker(const BufferView &buffer) : buffer(buffer) {}
+  // unpacked std::pmr::string, std::pmr::vector etc. allocate from resource, and interned strings
+  // are looked up in interner
+  BasicUnpacker(const BufferView &buffer, std::pmr::memory_resource *resource = std::pmr::get_default_resource(), Interner *interner = nullptr)
+    : buffer(buffer), resource_(resource), interner_(interner) {}
 
-  std::byte peek() {
-    if (off == buffer.size()) throw;
+  ~BasicUnpacker() { detail::count_read(off); }
+
+  // next byte, which is always a format byte. checked under either policy, which is what keeps a
+  // trusted unpack asking for more values than there are from running off the end
+  std::optional<std::byte> peek() {
+    if (!check(1)) return std::nullopt;
     return buffer[off];
   }
 
-  std::byte read() {
-    if (off == buffer.size()) throw;
+  std::optional<std::byte> read() {
+    if (!check(1)) return std::nullopt;
     return buffer[off++];
   }
 
+  // whether at least n bytes are left, which under policy::trusted is taken for granted
+  bool has(size_t n) {
+    if constexpr (Policy::bounds_checked) return check(n);
+    else return true;
+  }
+
+  // has() under either policy. if not, remembers how many more it would have taken, which is what
+  // tells a truncated input apart from an invalid one
+  bool check(size_t n) {
+    if (n <= size()) [[likely]] return true;
+    if (!missing_) missing_ = n - size();
+    fail(Errc::truncated);
+    return false;
+  }
+
+  // next n bytes with a single bounds check (none if trusted), nullopt if there are fewer left
+  std::optional<BufferView> read_span(size_t n) {
+    if (!has(n)) return std::nullopt;
+    const BufferView span = buffer.subspan(off, n);
+    off += n;
+    return span;
+  }
+
+  // like read_span(), but always checked and nothing is consumed (or recorded as missing)
+  std::optional<BufferView> peek_span(size_t n) const {
+    if (n > size()) return std::nullopt;
+    return buffer.subspan(off, n);
+  }
+
+  // records why unpacking failed, unless something already has. returns nullopt to be returned
+  std::nullopt_t fail(const Errc code) { return fail(code, off); }
+  std::nullopt_t fail(const Errc code, const size_t at) {
+    if (!error_) {
+      error_ = {code, at};
+      detail::count_failure(error_);
+    }
+    return std::nullopt;
+  }
+
   size_t size() const { return buffer.size() - off; }
+  size_t offset() const { return off; }
   bool at_end() const { return off == buffer.size(); }
+  // lower bound on the bytes past the end of the buffer that a failed unpack wanted, 0 if none
+  size_t missing() const { return missing_; }
+  const Error &error() const { return error_; }
+  std::pmr::memory_resource *resource() const { return resource_; }
+  Interner *interner() const { return interner_; }
 
 private:
   BufferView buffer;
+  std::pmr::memory_resource *resource_;
+  Interner *interner_;
   size_t off = 0;
+  size_t missing_ = 0;
+  Error error_;
 };
 
+using Unpacker = BasicUnpacker<policy::checked>;
+using TrustedUnpacker = BasicUnpacker<policy::trusted>;
+
 template <class T> std::optional<T> ok(const T &value) { return value; }
 
+struct array_header;
+struct map_header;
+
+namespace detail {
+
+// the types here that go through the primary impl<T> (define_pack() and so on), and are one value
+template <class T>
+concept one_value = std::is_scalar_v<T> || std::is_same_v<T, std::string_view> || std::is_same_v<T, interned> ||
+                    std::is_same_v<T, std::span<const std::byte>> || std::is_same_v<T, std::span<const uint8_t>> ||
+                    std::is_same_v<T, array_header> || std::is_same_v<T, map_header>;
+
+}
+
 template <class T>
 struct impl {
+  // values pack() emits, where the type alone says. nullopt for define_pack() types, which are
+  // counted instead (see detail::element_values())
+  static constexpr std::optional<size_t> values = detail::one_value<T> ? std::optional<size_t>(1) : std::nullopt;
+
   static void pack(Packer &packer, const T &value);
-  static std::optional<T> unpack(Unpacker &unpacker);
+  template <class Policy> static std::optional<T> unpack(BasicUnpacker<Policy> &unpacker);
+  // unpack() into an existing value, reusing whatever it has allocated. unless specialized, this
+  // unpacks a fresh value and moves it in. on failure value is left valid but unspecified
+  template <class Policy> static bool unpack_into(BasicUnpacker<Policy> &unpacker, T &value);
+  // exact number of bytes pack() emits. unless specialized, this packs into a NullSink and counts
+  static size_t packed_size(const T &value);
 };
 
-template <class T> void pack_one(Packer &packer, const T &value) { impl<T>::pack(packer, value); }
+template <class T>
+template <class Policy>
+bool impl<T>::unpack_into(BasicUnpacker<Policy> &unpacker, T &value) {
+  std::optional<T> result = unpack(unpacker);
+  if (result) value = std::move(*result);
+  return result.has_value();
+}
+
+template <class T>
+size_t impl<T>::packed_size(const T &value) {
+  NullSink sink;
+  Packer packer(sink);
+  pack(packer, value);
+  return packer.size();
+}
+
+// compile-time bounds on impl<T>::packed_size()
+inline constexpr size_t unbounded = std::numeric_limits<size_t>::max();
+template <class T> inline constexpr size_t min_packed_size = 0;
+template <class T> inline constexpr size_t max_packed_size = unbounded;
+
+template <class T>
+concept fixed_size = min_packed_size<T> == max_packed_size<T>;
+
+// whether impl<T>::packed_size() works the size out, rather than counting what pack() emits, and
+// so is worth calling to size a buffer up front. define_packed_size() sets it
+template <class T> inline constexpr bool has_packed_size = false;
+
+template <class T>
+concept presizable = fixed_size<T> || has_packed_size<T>;
+
+template <class T> constexpr void pack_one(Packer &packer, const T &value) { impl<T>::pack(packer, value); }
+
+template <class ...Ts>
+constexpr size_t packed_size(const Ts &...values) { return (size_t{0} + ... + impl<Ts>::packed_size(values)); }
 
 template <class ...Ts>
 Buffer pack(const Ts &...values) {
+  const detail::ScopedTimer timer(true);
   Packer packer;
+  // anything else would be packed twice, once just to count it
+  if constexpr ((presizable<Ts> && ...)) packer.reserve(packed_size(values...));
+  (pack_one<Ts>(packer, values), ...);
+  return packer.take();
+}
+
+// packs straight into a caller-provided sink. false if the sink ran out of space
+template <class ...Ts>
+bool pack_into(Sink &sink, const Ts &...values) {
+  const detail::ScopedTimer timer(true);
+  Packer packer(sink);
   (pack_one<Ts>(packer, values), ...);
-  return packer.get();
+  packer.flush();
+  return !packer.overflowed();
 }
 
-template <class T> std::optional<T> unpack_one(Unpacker &unpacker) { return impl<T>::unpack(unpacker); }
+// appends to an existing buffer, reusing whatever capacity it already has
+template <class ...Ts>
+bool pack_into(Buffer &buffer, const Ts &...values) {
+  VectorSink sink(buffer);
+  return pack_into(sink, values...);
+}
+
+template <class T, class Policy>
+std::optional<T> unpack_one(BasicUnpacker<Policy> &unpacker) { return impl<T>::unpack(unpacker); }
+
+template <class T, class Policy>
+bool unpack_one_into(BasicUnpacker<Policy> &unpacker, T &value) { return impl<T>::unpack_into(unpacker, value); }
+
+namespace detail {
+
+// an empty T to unpack into. allocates from the unpacker's memory resource if T takes a polymorphic
+// allocator, and impl<T>::construct() can pass it on to what T is made of (aggregates etc.)
+template <class T, class Policy>
+T construct(BasicUnpacker<Policy> &unpacker) {
+  if constexpr (requires { impl<T>::construct(unpacker); }) return impl<T>::construct(unpacker);
+  else return std::make_obj_using_allocator<T>(std::pmr::polymorphic_allocator<>(unpacker.resource()));
+}
+
+}
+
+// like unpack<T>(buffer), and if it fails, error says why and where
+template <class T, class Policy = policy::checked>
+std::optional<T> unpack(const BufferView &buffer, Error &error, std::pmr::memory_resource *resource = std::pmr::get_default_resource(), Interner *interner = nullptr) {
+  const detail::ScopedTimer timer(false);
+  BasicUnpacker<Policy> unpacker(buffer, resource, interner);
+  std::optional<T> result = unpack_one<T>(unpacker);
+  if (result && !unpacker.at_end()) result = unpacker.fail(Errc::trailing_bytes);
+  if (!result) unpacker.fail(Errc::invalid);
+  error = unpacker.error();
+  return result;
+}
 
 template <class T>
 std::optional<T> unpack(const BufferView &buffer) {
-  Unpacker unpacker(buffer);
-  const auto result = unpack_one<T>(unpacker);
-  return result && unpacker.at_end() ? result : std::nullopt;
+  Error error;
+  return unpack<T>(buffer, error);
+}
+
+// strings and containers in T that take a polymorphic allocator allocate from resource
+template <class T>
+std::optional<T> unpack(const BufferView &buffer, std::pmr::memory_resource *resource) {
+  Error error;
+  return unpack<T>(buffer, error, resource);
+}
+
+// interned strings in T are looked up in (and added to) interner, and outlive the buffer, except
+// for those it has no room for (id none), which view the buffer
+template <class T>
+std::optional<T> unpack(const BufferView &buffer, Interner &interner) {
+  Error error;
+  return unpack<T>(buffer, error, std::pmr::get_default_resource(), &interner);
+}
+
+// overwrites value, reusing the capacity its strings and containers already hold, so that decoding
+// message after message of the same shape into the same value stops allocating after the first.
+// that takes containers that never hold fewer elements than before: those a vector or map drops
+// go with what they had allocated, which is allocated again once a later message has that many.
+// on failure value is left valid but unspecified
+template <class T, class Policy = policy::checked>
+bool unpack_into(const BufferView &buffer, T &value, Error &error) {
+  const detail::ScopedTimer timer(false);
+  BasicUnpacker<Policy> unpacker(buffer);
+  bool ok = unpack_one_into(unpacker, value);
+  if (ok && !unpacker.at_end()) {
+    unpacker.fail(Errc::trailing_bytes);
+    ok = false;
+  }
+  if (!ok) unpacker.fail(Errc::invalid);
+  error = unpacker.error();
+  return ok;
+}
+
+template <class T>
+bool unpack_into(const BufferView &buffer, T &value) {
+  Error error;
+  return unpack_into(buffer, value, error);
 }
 
+// unpack() without the bounds checks, for buffers that passed validate()
+template <class T>
+std::optional<T> unpack_trusted(const BufferView &buffer, std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+  Error error;
+  return unpack<T, policy::trusted>(buffer, error, resource);
+}
+
+// bump allocator to unpack a batch of values into (as std::pmr types), all of them freed at once
+// when it goes away. its first block is sized from the packed size of the batch, which decoded is
+// rarely much bigger, so that usually there's only the one
+class Arena : public std::pmr::monotonic_buffer_resource {
+public:
+  explicit Arena(const size_t packed_size, std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+    : std::pmr::monotonic_buffer_resource(2 * packed_size + 1024, upstream) {}
+};
+
 template <class ...Ts>
 requires (sizeof...(Ts) > 1)
 std::optional<std::tuple<Ts...>> unpack(const BufferView &buffer) {
   Unpacker unpacker(buffer);
   // use initializer list to force left-to-right eval
   const std::tuple<std::optional<Ts>...> result{unpack_one<Ts>(unpacker)...};
-  const bool ok = (std::get<std::optional<Ts>>(result) && ...) && unpacker.at_end();
-  if (ok) return {*std::get<std::optional<Ts>>(result)...};
-  else return std::nullopt;
+  return std::apply([&](const std::optional<Ts> &...values) -> std::optional<std::tuple<Ts...>> {
+    if ((values && ...) && unpacker.at_end()) return std::tuple<Ts...>{*values...};
+    else return std::nullopt;
+  }, result);
 }
 
 namespace format {
@@ -129,316 +914,2499 @@ constexpr std::byte map_32          {0xdf};
 constexpr std::byte negative_fixint {0xe0};
 }
 
-}
+enum class Type { nil, bool_, int_, float_, str, bin, array, map, ext };
 
-// syntactic sugar overdose :)
-#define define_pack(T) template<> inline void msgpack::impl<T>::pack(Packer &packer, const T &value)
-#define define_unpack(T) template<> inline std::optional<T> msgpack::impl<T>::unpack(Unpacker &unpacker)
-#define $fail() return std::nullopt
-#define $expect(cond) if (!static_cast<bool>(cond)) $fail()
-#define $expect_peek() ({ $expect(!unpacker.at_end()); unpacker.peek(); })
-#define $expect_read() ({ $expect(!unpacker.at_end()); unpacker.read(); })
-#define $expect_byte(b) $expect($expect_read() == b)
-#define $expect_in_urange(value, T) $expect((value) <= std::numeric_limits<T>::max())
-#define $expect_in_range(value, T) $expect(std::numeric_limits<T>::min() <= (value) && (value) <= std::numeric_limits<T>::max())
-#define $unwrap(opt_expr) ({ auto&& opt = (opt_expr); if (!opt) $fail(); *opt; })
+namespace detail {
 
-// nil
-define_pack(std::nullptr_t) { packer.push(format::nil); }
-define_unpack(std::nullptr_t) { $expect_byte(format::nil); return nullptr; }
+// what a format byte says about the value it starts, so that every decoder classifies it with one
+// table load instead of its own chain of compares
+struct Lead {
+  bool valid;
+  Type type;
+  uint8_t width;     // bytes after the format byte holding the value (int, float) or the length (str, bin, array, map, ext)
+  int8_t value;      // fixint value, fixstr/fixarray/fixmap/fixext length, bool value
+  bool is_signed;    // int_8..int_64: the payload is two's complement
+};
 
-// bool
-define_pack(bool) { packer.push(value ? format::true_ : format::false_); }
-define_unpack(bool) {
-  switch ($expect_read()) {
-    case format::true_: return true;
-    case format::false_: return false;
-    default: $fail();
-  }
+constexpr std::array<Lead, 256> make_lead_table() {
+  std::array<Lead, 256> table{};
+  for (int b = 0x00; b <= 0x7f; b++) table[b] = {true, Type::int_, 0, static_cast<int8_t>(b), false};
+  for (int b = 0x80; b <= 0x8f; b++) table[b] = {true, Type::map, 0, static_cast<int8_t>(b & 0x0f), false};
+  for (int b = 0x90; b <= 0x9f; b++) table[b] = {true, Type::array, 0, static_cast<int8_t>(b & 0x0f), false};
+  for (int b = 0xa0; b <= 0xbf; b++) table[b] = {true, Type::str, 0, static_cast<int8_t>(b & 0x1f), false};
+  for (int b = 0xe0; b <= 0xff; b++) table[b] = {true, Type::int_, 0, static_cast<int8_t>(b - 0x100), true};
+
+  auto set = [&](const std::byte fmt, const Type type, const uint8_t width, const int8_t value = 0, const bool is_signed = false) {
+    table[std::to_integer<uint8_t>(fmt)] = {true, type, width, value, is_signed};
+  };
+  set(format::nil,       Type::nil,    0);
+  set(format::false_,    Type::bool_,  0, 0);
+  set(format::true_,     Type::bool_,  0, 1);
+  set(format::bin_8,     Type::bin,    1);
+  set(format::bin_16,    Type::bin,    2);
+  set(format::bin_32,    Type::bin,    4);
+  set(format::ext_8,     Type::ext,    1);
+  set(format::ext_16,    Type::ext,    2);
+  set(format::ext_32,    Type::ext,    4);
+  set(format::float_32,  Type::float_, 4);
+  set(format::float_64,  Type::float_, 8);
+  set(format::uint_8,    Type::int_,   1);
+  set(format::uint_16,   Type::int_,   2);
+  set(format::uint_32,   Type::int_,   4);
+  set(format::uint_64,   Type::int_,   8);
+  set(format::int_8,     Type::int_,   1, 0, true);
+  set(format::int_16,    Type::int_,   2, 0, true);
+  set(format::int_32,    Type::int_,   4, 0, true);
+  set(format::int_64,    Type::int_,   8, 0, true);
+  set(format::fixext_1,  Type::ext,    0, 1);
+  set(format::fixext_2,  Type::ext,    0, 2);
+  set(format::fixext_4,  Type::ext,    0, 4);
+  set(format::fixext_8,  Type::ext,    0, 8);
+  set(format::fixext_16, Type::ext,    0, 16);
+  set(format::str_8,     Type::str,    1);
+  set(format::str_16,    Type::str,    2);
+  set(format::str_32,    Type::str,    4);
+  set(format::array_16,  Type::array,  2);
+  set(format::array_32,  Type::array,  4);
+  set(format::map_16,    Type::map,    2);
+  set(format::map_32,    Type::map,    4);
+  return table;
 }
 
-namespace msgpack::detail {
+inline constexpr std::array<Lead, 256> lead_table = make_lead_table();
+
+constexpr Lead lead(const std::byte b) { return lead_table[std::to_integer<uint8_t>(b)]; }
+
+constexpr std::array<instrument::Family, 256> make_family_table() {
+  using instrument::Family;
+  std::array<Family, 256> table{};
+  for (int b = 0x00; b <= 0x7f; b++) table[b] = Family::fixint;
+  for (int b = 0x80; b <= 0x8f; b++) table[b] = Family::map;
+  for (int b = 0x90; b <= 0x9f; b++) table[b] = Family::array;
+  for (int b = 0xa0; b <= 0xbf; b++) table[b] = Family::fixstr;
+  for (int b = 0xe0; b <= 0xff; b++) table[b] = Family::negative_fixint;
+
+  auto set = [&](const std::byte fmt, const Family family) { table[std::to_integer<uint8_t>(fmt)] = family; };
+  set(format::nil,       Family::nil);
+  set(format::false_,    Family::bool_);
+  set(format::true_,     Family::bool_);
+  set(format::bin_8,     Family::bin_8);
+  set(format::bin_16,    Family::bin_16);
+  set(format::bin_32,    Family::bin_32);
+  set(format::ext_8,     Family::ext);
+  set(format::ext_16,    Family::ext);
+  set(format::ext_32,    Family::ext);
+  set(format::float_32,  Family::float_32);
+  set(format::float_64,  Family::float_64);
+  set(format::uint_8,    Family::uint_8);
+  set(format::uint_16,   Family::uint_16);
+  set(format::uint_32,   Family::uint_32);
+  set(format::uint_64,   Family::uint_64);
+  set(format::int_8,     Family::int_8);
+  set(format::int_16,    Family::int_16);
+  set(format::int_32,    Family::int_32);
+  set(format::int_64,    Family::int_64);
+  set(format::fixext_1,  Family::ext);
+  set(format::fixext_2,  Family::ext);
+  set(format::fixext_4,  Family::ext);
+  set(format::fixext_8,  Family::ext);
+  set(format::fixext_16, Family::ext);
+  set(format::str_8,     Family::str_8);
+  set(format::str_16,    Family::str_16);
+  set(format::str_32,    Family::str_32);
+  set(format::array_16,  Family::array);
+  set(format::array_32,  Family::array);
+  set(format::map_16,    Family::map);
+  set(format::map_32,    Family::map);
+  return table;
+}
 
-template <std::integral T> requires std::is_unsigned_v<T>
-std::optional<T> unpack_uint(Unpacker &unpacker) {
-  const uint64_t value = $unwrap(unpack_one<uint64_t>(unpacker));
-  $expect_in_urange(value, T);
-  return static_cast<T>(value);
+inline constexpr std::array<instrument::Family, 256> family_table = make_family_table();
+
+// n values of format fmt packed. after they are written, so that what a packer throws away (as
+// when packed_size() packs into a NullSink to count) isn't counted
+constexpr void count_packed(const Packer &packer, const std::byte fmt, const size_t n = 1) {
+  if constexpr (instrument::enabled) if (!std::is_constant_evaluated() && !packer.overflowed())
+    instrument::detail::bump(instrument::detail::local().packed[static_cast<size_t>(family_table[std::to_integer<uint8_t>(fmt)])], n);
 }
 
-template <std::integral T> requires std::is_signed_v<T>
-std::optional<T> unpack_int(Unpacker &unpacker) {
-  const int64_t value = $unwrap(unpack_one<int64_t>(unpacker));
-  $expect_in_range(value, T);
-  return static_cast<T>(value);
+inline void count_unpacked(const std::byte fmt, const size_t n = 1) {
+  if constexpr (instrument::enabled) instrument::detail::bump(instrument::detail::local().unpacked[static_cast<size_t>(family_table[std::to_integer<uint8_t>(fmt)])], n);
 }
 
+// every value in a block that the bulk paths went through in one go, going by format bytes. holds
+// for those blocks since they have no str, bin or ext in them, which is all that has a payload
+// other than what the lead table gives the width of
+inline void count_packed(const Packer &packer, const BufferView block) {
+  if constexpr (instrument::enabled) for (size_t off = 0; off < block.size(); off += 1 + lead(block[off]).width) count_packed(packer, block[off]);
 }
 
-// int
-define_pack(uint8_t)    { pack_one<uint64_t>(packer, value); }
-define_unpack(uint8_t)  { return detail::unpack_uint<uint8_t>(unpacker); }
-define_pack(uint16_t)   { pack_one<uint64_t>(packer, value); }
-define_unpack(uint16_t) { return detail::unpack_uint<uint16_t>(unpacker); }
-define_pack(uint32_t)   { pack_one<uint64_t>(packer, value); }
-define_unpack(uint32_t) { return detail::unpack_uint<uint32_t>(unpacker); }
-
-define_pack(uint64_t) {
-  constexpr uint64_t one = 1;
-  if      (value < (one << 7))  goto pack8;
-  else if (value < (one << 8))  { packer.push(format::uint_8);  goto pack8; }
-  else if (value < (one << 16)) { packer.push(format::uint_16); goto pack16; }
-  else if (value < (one << 32)) { packer.push(format::uint_32); goto pack32; }
-  else                          { packer.push(format::uint_64); goto pack64; }
-
-  return;
-
-  pack64:
-  packer.push(value >> 56); packer.push(value >> 48);
-  packer.push(value >> 40); packer.push(value >> 32);
-  pack32:
-  packer.push(value >> 24); packer.push(value >> 16);
-  pack16:
-  packer.push(value >>  8);
-  pack8:
-  packer.push(value >>  0);
-}
-
-define_unpack(uint64_t) {
-  auto read8 = [&]() { return std::to_integer<uint64_t>(unpacker.read()); };
-  auto read16 = [&]() { return (read8()  <<  8) | read8(); };
-  auto read32 = [&]() { return (read16() << 16) | read16(); };
-  auto read64 = [&]() { return (read32() << 32) | read32(); };
-
-  const std::byte first_byte = $expect_read();
-  switch (first_byte) {
-    case format::uint_8:   { $expect(unpacker.size() >= 1); return read8(); }
-    case format::uint_16:  { $expect(unpacker.size() >= 2); return read16(); }
-    case format::uint_32:  { $expect(unpacker.size() >= 4); return read32(); }
-    case format::uint_64:  { $expect(unpacker.size() >= 8); return read64(); }
-
-    default: {
-      const uint8_t value = std::to_integer<uint8_t>(first_byte);
-      if      ((value & 0b1000'0000) == 0)  return value;
-      else if (value == 0b1110'0000)        return 0;
-      else                                  $fail();
-    }
-  }
-}
-
-define_pack(int8_t)     { pack_one<int64_t>(packer, value); }
-define_unpack(int8_t)   { return detail::unpack_int<int8_t>(unpacker); }
-define_pack(int16_t)    { pack_one<int64_t>(packer, value); }
-define_unpack(int16_t)  { return detail::unpack_int<int16_t>(unpacker); }
-define_pack(int32_t)    { pack_one<int64_t>(packer, value); }
-define_unpack(int32_t)  { return detail::unpack_int<int32_t>(unpacker); }
-
-define_pack(int64_t) {
-  constexpr int64_t one = 1;
-  const uint64_t uvalue = value;
-  if      (value >= 0)            pack_one<uint64_t>(packer, uvalue);
-  else if (value >= (-one << 5))  packer.push(uvalue);
-  else if (value >= (-one << 8))  { packer.push(format::int_8); goto pack8; }
-  else if (value >= (-one << 16)) { packer.push(format::int_16); goto pack16; }
-  else if (value >= (-one << 32)) { packer.push(format::int_32); goto pack32; }
-  else                            { packer.push(format::int_64); goto pack64; }
+inline void count_unpacked(const BufferView block) {
+  if constexpr (instrument::enabled) for (size_t off = 0; off < block.size(); off += 1 + lead(block[off]).width) count_unpacked(block[off]);
+}
 
-  return;
+}
 
-  pack64:
-  packer.push(uvalue >> 56); packer.push(uvalue >> 48);
-  packer.push(uvalue >> 40); packer.push(uvalue >> 32);
-  pack32:
-  packer.push(uvalue >> 24); packer.push(uvalue >> 16);
-  pack16:
-  packer.push(uvalue >>  8);
-  pack8:
-  packer.push(uvalue >>  0);
 }
 
-define_unpack(int64_t) {
-  auto read8 = [&]() { return std::to_integer<uint64_t>(unpacker.read()); };
-  auto read16 = [&]() { return (read8()  <<  8) | read8(); };
-  auto read32 = [&]() { return (read16() << 16) | read16(); };
-  auto read64 = [&]() { return (read32() << 32) | read32(); };
+// syntactic sugar overdose :)
+#define define_pack(T) template<> inline void msgpack::impl<T>::pack(Packer &packer, const T &value)
+// same, for types that can also be packed at compile time (see pack_static())
+#define define_constexpr_pack(T) template<> constexpr void msgpack::impl<T>::pack(Packer &packer, [[maybe_unused]] const T &value)
+#define define_unpack(T) template<> template<class Policy> inline std::optional<T> msgpack::impl<T>::unpack(BasicUnpacker<Policy> &unpacker)
+#define define_unpack_into(T) template<> template<class Policy> inline bool msgpack::impl<T>::unpack_into(BasicUnpacker<Policy> &unpacker, T &value)
+#define define_packed_size(T) \
+  template<> inline constexpr bool msgpack::has_packed_size<T> = true; \
+  template<> inline size_t msgpack::impl<T>::packed_size(const T &value)
+#define define_packed_size_bounds(T, min, max) \
+  template<> inline constexpr size_t msgpack::min_packed_size<T> = min; \
+  template<> inline constexpr size_t msgpack::max_packed_size<T> = max
+// packs the fields of an aggregate (up to 16, no bases) in order, without having to list them
+#define define_aggregate(T) \
+  template<> struct msgpack::detail::raw<T> : msgpack::detail::aggregate_raw<T> {}; \
+  template<> struct msgpack::impl<T> : msgpack::detail::aggregate_impl<T> {}; \
+  template<> inline constexpr bool msgpack::has_packed_size<T> = msgpack::detail::aggregate_bounds<T>::sized; \
+  define_packed_size_bounds(T, msgpack::detail::aggregate_bounds<T>::min, msgpack::detail::aggregate_bounds<T>::max)
+// packs T as an ext, going by the specialization of msgpack::ext<T>
+#define define_ext(T) \
+  template<> struct msgpack::impl<T> : msgpack::detail::ext_impl<T> {}; \
+  template<> inline constexpr bool msgpack::has_packed_size<T> = true
+#define $fail() return std::nullopt
+#define $expect(cond) if (!static_cast<bool>(cond)) $fail()
+#define $expect_or(cond, code) if (!static_cast<bool>(cond)) return unpacker.fail(code)
+#define $expect_peek() $unwrap(unpacker.peek())
+#define $expect_read() $unwrap(unpacker.read())
+#define $expect_byte(b) $expect(detail::expect_byte(unpacker, b))
+#define $expect_in_urange(value, T) $expect_or((value) <= std::numeric_limits<T>::max(), Errc::out_of_range)
+#define $unwrap(opt_expr) ({ auto&& opt = (opt_expr); if (!opt) $fail(); *opt; })
 
-  const std::byte first_byte = $expect_read();
-  switch (first_byte) {
-    case format::uint_8:   { $expect(unpacker.size() >= 1); return read8(); }
-    case format::int_8:    { $expect(unpacker.size() >= 1); return static_cast<int8_t>(read8()); }
-    case format::uint_16:  { $expect(unpacker.size() >= 2); return read16(); }
-    case format::int_16:   { $expect(unpacker.size() >= 2); return static_cast<int16_t>(read16()); }
-    case format::uint_32:  { $expect(unpacker.size() >= 4); return read32(); }
-    case format::int_32:   { $expect(unpacker.size() >= 4); return static_cast<int32_t>(read32()); }
-    case format::int_64:   { $expect(unpacker.size() >= 8); return read64(); }
+namespace msgpack::detail {
 
-    case format::uint_64: {
-      $expect(unpacker.size() >= 8);
-      const uint64_t bits = read64();
-      $expect_in_range(bits, int64_t);
-      return std::bit_cast<int64_t>(bits);
-    }
+template <std::unsigned_integral T>
+constexpr T byteswap(T value) {
+#if defined(__GNUC__) || defined(__clang__)
+  if constexpr (sizeof(T) == 2) return __builtin_bswap16(value);
+  if constexpr (sizeof(T) == 4) return __builtin_bswap32(value);
+  if constexpr (sizeof(T) == 8) return __builtin_bswap64(value);
+#endif
+  T result = 0;
+  for (size_t i = 0; i < sizeof(T); i++, value >>= 8) result = (result << 8) | (value & 0xff);
+  return result;
+}
 
-    default: {
-      const uint8_t value = std::to_integer<uint8_t>(first_byte);
-      if      ((value & 0b1000'0000) == 0)            return value;
-      else if ((value & 0b1110'0000) == 0b1110'0000)  return static_cast<int8_t>(value);
-      else                                            $fail();
-    }
-  }
+template <std::unsigned_integral T>
+constexpr T big_endian(const T value) {
+  if constexpr (std::endian::native == std::endian::big || sizeof(T) == 1) return value;
+  else return byteswap(value);
+}
+
+template <std::unsigned_integral T>
+T load_big_endian(const std::byte *bytes) {
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return big_endian(value);
+}
+
+template <std::unsigned_integral T>
+constexpr void store_big_endian(std::byte *bytes, const T value) {
+  if (std::is_constant_evaluated()) {
+    for (size_t i = 0; i < sizeof(T); i++) bytes[i] = static_cast<std::byte>(value >> 8 * (sizeof(T) - 1 - i));
+    return;
+  }
+  const T payload = big_endian(value);
+  std::memcpy(bytes, &payload, sizeof(T));
+}
+
+// format byte followed by a big-endian payload, as a single write
+template <std::unsigned_integral T>
+constexpr void pack_tagged(Packer &packer, const std::byte fmt, const T value) {
+  std::array<std::byte, 1 + sizeof(T)> bytes{fmt};
+  store_big_endian(&bytes[1], value);
+  packer.write(bytes);
+  count_packed(packer, fmt);
+}
+
+// a value that is nothing but its format byte, or the one byte header of one
+constexpr void push_format(Packer &packer, const std::byte fmt) {
+  packer.push(fmt);
+  count_packed(packer, fmt);
+}
+
+template <std::unsigned_integral T, class Policy>
+std::optional<T> unpack_big_endian(BasicUnpacker<Policy> &unpacker) {
+  const BufferView bytes = $unwrap(unpacker.read_span(sizeof(T)));
+  return load_big_endian<T>(bytes.data());
+}
+
+// the format byte b that was just read isn't one that was expected
+template <class Policy>
+std::nullopt_t mismatch(BasicUnpacker<Policy> &unpacker, const std::byte b) {
+  return unpacker.fail(lead(b).valid ? Errc::type_mismatch : Errc::invalid, unpacker.offset() - 1);
+}
+
+// reads a format byte, which has to be one of type
+template <class Policy>
+std::optional<Lead> unpack_lead(BasicUnpacker<Policy> &unpacker, const Type type) {
+  const std::byte b = $expect_read();
+  const Lead lead = detail::lead(b);
+  if (lead.type != type || !lead.valid) [[unlikely]] return mismatch(unpacker, b);
+  count_unpacked(b);
+  return lead;
+}
+
+// reads a format byte, which has to be b
+template <class Policy>
+bool expect_byte(BasicUnpacker<Policy> &unpacker, const std::byte b) {
+  const std::optional<std::byte> read = unpacker.read();
+  if (read && *read != b) mismatch(unpacker, *read);
+  if (read == b) count_unpacked(b);
+  return read == b;
+}
+
+// width is one of 0, 1, 2, 4, 8
+inline uint64_t load_big_endian(const std::byte *bytes, const uint8_t width) {
+  switch (width) {
+    case 0:  return 0;
+    case 1:  return load_big_endian<uint8_t>(bytes);
+    case 2:  return load_big_endian<uint16_t>(bytes);
+    case 4:  return load_big_endian<uint32_t>(bytes);
+    default: return load_big_endian<uint64_t>(bytes);
+  }
+}
+
+// length of a str, bin, array, map or ext whose format byte has just been read
+template <class Policy>
+std::optional<uint64_t> unpack_length(BasicUnpacker<Policy> &unpacker, const Lead lead) {
+  if (lead.width == 0) return static_cast<uint8_t>(lead.value);
+  const BufferView bytes = $unwrap(unpacker.read_span(lead.width));
+  return load_big_endian(bytes.data(), lead.width);
+}
+
+// any int format as 64 bits, plus whether to read them as a negative int64_t
+struct Integer {
+  uint64_t bits;
+  bool negative;
+};
+
+template <class Policy>
+std::optional<Integer> unpack_integer(BasicUnpacker<Policy> &unpacker) {
+  const Lead lead = $unwrap(unpack_lead(unpacker, Type::int_));
+  if (lead.width == 0) return Integer{static_cast<uint64_t>(int64_t{lead.value}), lead.value < 0};
+
+  const BufferView bytes = $unwrap(unpacker.read_span(lead.width));
+  uint64_t bits = load_big_endian(bytes.data(), lead.width);
+  if (lead.is_signed) {
+    const unsigned shift = 64 - 8 * lead.width;
+    bits = static_cast<uint64_t>(static_cast<int64_t>(bits << shift) >> shift);
+  }
+  return Integer{bits, lead.is_signed && static_cast<int64_t>(bits) < 0};
+}
+
+}
+
+// nil
+define_constexpr_pack(std::nullptr_t) { detail::push_format(packer, format::nil); }
+define_unpack(std::nullptr_t) { $expect_byte(format::nil); return nullptr; }
+template<> constexpr size_t msgpack::impl<std::nullptr_t>::packed_size(const std::nullptr_t &) { return 1; }
+define_packed_size_bounds(std::nullptr_t, 1, 1);
+
+// bool
+define_constexpr_pack(bool) { detail::push_format(packer, value ? format::true_ : format::false_); }
+define_unpack(bool) {
+  switch (const std::byte b = $expect_read()) {
+    case format::true_: detail::count_unpacked(b); return true;
+    case format::false_: detail::count_unpacked(b); return false;
+    default: return detail::mismatch(unpacker, b);
+  }
+}
+template<> constexpr size_t msgpack::impl<bool>::packed_size(const bool &) { return 1; }
+define_packed_size_bounds(bool, 1, 1);
+
+namespace msgpack::detail {
+
+template <std::integral T, class Policy> requires std::is_unsigned_v<T>
+std::optional<T> unpack_uint(BasicUnpacker<Policy> &unpacker) {
+  const size_t at = unpacker.offset();
+  const Integer value = $unwrap(unpack_integer(unpacker));
+  if (value.negative || value.bits > std::numeric_limits<T>::max()) return unpacker.fail(Errc::out_of_range, at);
+  return static_cast<T>(value.bits);
+}
+
+template <std::integral T, class Policy> requires std::is_signed_v<T>
+std::optional<T> unpack_int(BasicUnpacker<Policy> &unpacker) {
+  const size_t at = unpacker.offset();
+  const Integer value = $unwrap(unpack_integer(unpacker));
+  const bool in_range = value.negative ? static_cast<int64_t>(value.bits) >= std::numeric_limits<T>::min()
+                                       : value.bits <= static_cast<uint64_t>(std::numeric_limits<T>::max());
+  if (!in_range) return unpacker.fail(Errc::out_of_range, at);
+  return static_cast<T>(value.bits);
+}
+
+}
+
+// int
+define_constexpr_pack(uint8_t)  { pack_one<uint64_t>(packer, value); }
+define_unpack(uint8_t)          { return detail::unpack_uint<uint8_t>(unpacker); }
+define_constexpr_pack(uint16_t) { pack_one<uint64_t>(packer, value); }
+define_unpack(uint16_t)         { return detail::unpack_uint<uint16_t>(unpacker); }
+define_constexpr_pack(uint32_t) { pack_one<uint64_t>(packer, value); }
+define_unpack(uint32_t)         { return detail::unpack_uint<uint32_t>(unpacker); }
+
+namespace msgpack::detail {
+
+// the low `width` bytes of value, big-endian. falls through the cases rather than jumping into
+// them, which constant evaluation doesn't allow
+constexpr void pack_payload(Packer &packer, const uint64_t value, const size_t width) {
+  switch (width) {
+    case 8:
+      packer.push(value >> 56); packer.push(value >> 48);
+      packer.push(value >> 40); packer.push(value >> 32);
+      [[fallthrough]];
+    case 4:
+      packer.push(value >> 24); packer.push(value >> 16);
+      [[fallthrough]];
+    case 2:
+      packer.push(value >>  8);
+      [[fallthrough]];
+    default:
+      packer.push(value >>  0);
+  }
+}
+
+// format byte fmt and then the low width bytes of value, or with width 0 a fixint, which is its
+// own format byte
+constexpr void pack_int(Packer &packer, const std::byte fmt, const uint64_t value, const size_t width) {
+  if (width == 0) packer.push(value);
+  else {
+    packer.push(fmt);
+    pack_payload(packer, value, width);
+  }
+  count_packed(packer, fmt);
+}
+
+}
+
+define_constexpr_pack(uint64_t) {
+  constexpr uint64_t one = 1;
+  if      (value < (one << 7))  detail::pack_int(packer, format::positive_fixint, value, 0);
+  else if (value < (one << 8))  detail::pack_int(packer, format::uint_8, value, 1);
+  else if (value < (one << 16)) detail::pack_int(packer, format::uint_16, value, 2);
+  else if (value < (one << 32)) detail::pack_int(packer, format::uint_32, value, 4);
+  else                          detail::pack_int(packer, format::uint_64, value, 8);
+}
+
+define_unpack(uint64_t) { return detail::unpack_uint<uint64_t>(unpacker); }
+
+template<> constexpr size_t msgpack::impl<uint64_t>::packed_size(const uint64_t &value) {
+  constexpr uint64_t one = 1;
+  if      (value < (one << 7))  return 1;
+  else if (value < (one << 8))  return 2;
+  else if (value < (one << 16)) return 3;
+  else if (value < (one << 32)) return 5;
+  else                          return 9;
+}
+
+template<> constexpr size_t msgpack::impl<uint8_t>::packed_size(const uint8_t &value)   { return impl<uint64_t>::packed_size(value); }
+template<> constexpr size_t msgpack::impl<uint16_t>::packed_size(const uint16_t &value) { return impl<uint64_t>::packed_size(value); }
+template<> constexpr size_t msgpack::impl<uint32_t>::packed_size(const uint32_t &value) { return impl<uint64_t>::packed_size(value); }
+define_packed_size_bounds(uint8_t, 1, 2);
+define_packed_size_bounds(uint16_t, 1, 3);
+define_packed_size_bounds(uint32_t, 1, 5);
+define_packed_size_bounds(uint64_t, 1, 9);
+template<> inline constexpr bool msgpack::has_packed_size<uint8_t> = true;
+template<> inline constexpr bool msgpack::has_packed_size<uint16_t> = true;
+template<> inline constexpr bool msgpack::has_packed_size<uint32_t> = true;
+template<> inline constexpr bool msgpack::has_packed_size<uint64_t> = true;
+
+define_constexpr_pack(int8_t)   { pack_one<int64_t>(packer, value); }
+define_unpack(int8_t)           { return detail::unpack_int<int8_t>(unpacker); }
+define_constexpr_pack(int16_t)  { pack_one<int64_t>(packer, value); }
+define_unpack(int16_t)          { return detail::unpack_int<int16_t>(unpacker); }
+define_constexpr_pack(int32_t)  { pack_one<int64_t>(packer, value); }
+define_unpack(int32_t)          { return detail::unpack_int<int32_t>(unpacker); }
+
+define_constexpr_pack(int64_t) {
+  constexpr int64_t one = 1;
+  const uint64_t uvalue = value;
+  if      (value >= 0)            pack_one<uint64_t>(packer, uvalue);
+  else if (value >= (-one << 5))  detail::pack_int(packer, format::negative_fixint, uvalue, 0);
+  else if (value >= (-one << 7))  detail::pack_int(packer, format::int_8, uvalue, 1);
+  else if (value >= (-one << 15)) detail::pack_int(packer, format::int_16, uvalue, 2);
+  else if (value >= (-one << 31)) detail::pack_int(packer, format::int_32, uvalue, 4);
+  else                            detail::pack_int(packer, format::int_64, uvalue, 8);
+}
+
+define_unpack(int64_t) { return detail::unpack_int<int64_t>(unpacker); }
 
+template<> constexpr size_t msgpack::impl<int64_t>::packed_size(const int64_t &value) {
+  constexpr int64_t one = 1;
+  if      (value >= 0)            return impl<uint64_t>::packed_size(value);
+  else if (value >= (-one << 5))  return 1;
+  else if (value >= (-one << 7))  return 2;
+  else if (value >= (-one << 15)) return 3;
+  else if (value >= (-one << 31)) return 5;
+  else                            return 9;
 }
 
+template<> constexpr size_t msgpack::impl<int8_t>::packed_size(const int8_t &value)   { return impl<int64_t>::packed_size(value); }
+template<> constexpr size_t msgpack::impl<int16_t>::packed_size(const int16_t &value) { return impl<int64_t>::packed_size(value); }
+template<> constexpr size_t msgpack::impl<int32_t>::packed_size(const int32_t &value) { return impl<int64_t>::packed_size(value); }
+define_packed_size_bounds(int8_t, 1, 2);
+define_packed_size_bounds(int16_t, 1, 3);
+define_packed_size_bounds(int32_t, 1, 5);
+define_packed_size_bounds(int64_t, 1, 9);
+template<> inline constexpr bool msgpack::has_packed_size<int8_t> = true;
+template<> inline constexpr bool msgpack::has_packed_size<int16_t> = true;
+template<> inline constexpr bool msgpack::has_packed_size<int32_t> = true;
+template<> inline constexpr bool msgpack::has_packed_size<int64_t> = true;
+
 // the following technique is inspired by quantum bogosort
 static_assert(sizeof(float) == 4);
 static_assert(std::numeric_limits<float>::is_iec559);
 
-define_pack(float) {
-  packer.push(format::float_32);
-  if constexpr (std::endian::native == std::endian::big) {
-    for (const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value), *end = ptr + 4; ptr < end; ptr++)
-      packer.push(*ptr);
-  } else {
-    for (const uint8_t *start = reinterpret_cast<const uint8_t *>(&value), *ptr = start + 3; ptr >= start; ptr--)
-      packer.push(*ptr);
-  }
-}
+define_constexpr_pack(float) { detail::pack_tagged(packer, format::float_32, std::bit_cast<uint32_t>(value)); }
 
 define_unpack(float) {
-  auto read8 = [&]() { return std::to_integer<uint32_t>(unpacker.read()); };
-
   $expect_byte(format::float_32);
-  $expect(unpacker.size() >= 4);
-  if constexpr (std::endian::native == std::endian::big) {
-    const uint32_t bit_value = read8() | (read8() << 8) | (read8() << 16) | (read8() << 24);
-    return std::bit_cast<float>(bit_value);
-  } else {
-    const uint32_t bit_value = (read8() << 24) | (read8() << 16) | (read8() << 8) | read8();
-    return std::bit_cast<float>(bit_value);
-  }
+  return std::bit_cast<float>($unwrap(detail::unpack_big_endian<uint32_t>(unpacker)));
 }
 
+template<> constexpr size_t msgpack::impl<float>::packed_size(const float &) { return 5; }
+define_packed_size_bounds(float, 5, 5);
+
 static_assert(sizeof(double) == 8);
 static_assert(std::numeric_limits<double>::is_iec559);
 
-define_pack(double) {
-  packer.push(format::float_64);
-  if constexpr (std::endian::native == std::endian::big) {
-    for (const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value), *end = ptr + 8; ptr < end; ptr++)
-      packer.push(*ptr);
-  } else {
-    for (const uint8_t *start = reinterpret_cast<const uint8_t *>(&value), *ptr = start + 7; ptr >= start; ptr--)
-      packer.push(*ptr);
-  }
-}
+define_constexpr_pack(double) { detail::pack_tagged(packer, format::float_64, std::bit_cast<uint64_t>(value)); }
 
 define_unpack(double) {
-  auto read8 = [&]() { return std::to_integer<uint64_t>(unpacker.read()); };
-
   $expect_byte(format::float_64);
-  $expect(unpacker.size() >= 8);
-  if constexpr (std::endian::native == std::endian::big) {
-    const uint64_t bit_value = (read8() <<  0) | (read8() <<  8) | (read8() << 16) | (read8() << 24)
-                             | (read8() << 32) | (read8() << 40) | (read8() << 48) | (read8() << 56);
-    return std::bit_cast<double>(bit_value);
-  } else {
-    const uint64_t bit_value = (read8() << 56) | (read8() << 48) | (read8() << 40) | (read8() << 32)
-                             | (read8() << 24) | (read8() << 16) | (read8() <<  8) | (read8() <<  0);
-    return std::bit_cast<double>(bit_value);
-  }
+  return std::bit_cast<double>($unwrap(detail::unpack_big_endian<uint64_t>(unpacker)));
 }
 
+template<> constexpr size_t msgpack::impl<double>::packed_size(const double &) { return 9; }
+define_packed_size_bounds(double, 9, 9);
+
 // bytes-like
 namespace msgpack::detail {
 
 template <class T>
 concept byte_like = (sizeof(T) == 1) && requires(T b) { static_cast<uint8_t>(b); };
 
-template <std::ranges::range T, std::byte fmt8, std::byte fmt16, std::byte fmt32>
+// the raw bytes of value, one at a time when at compile time since as_bytes() can't be used there
+template <std::ranges::contiguous_range T>
 requires byte_like<std::ranges::range_value_t<T>>
-void pack_bytes(Packer &packer, const T &value) {
-  using Byte = std::ranges::range_value_t<T>;
-  auto pack8 = [&](const uint64_t value) { packer.push(static_cast<uint8_t>(value)); };
-  auto pack16 = [&](const uint64_t value) { pack8(value >> 8); pack8(value); };
-  auto pack32 = [&](const uint64_t value) { pack16(value >> 16); pack16(value); };
+constexpr void write_bytes(Packer &packer, const T &value) {
+  if (std::is_constant_evaluated()) for (const auto b : value) packer.push(static_cast<std::byte>(b));
+  else packer.write(std::as_bytes(std::span(value)));
+}
 
+template <std::ranges::contiguous_range T, std::byte fmt8, std::byte fmt16, std::byte fmt32>
+requires byte_like<std::ranges::range_value_t<T>>
+constexpr void pack_bytes(Packer &packer, const T &value) {
   constexpr uint64_t one = 1;
-  const size_t size = value.size();
-  if (size < (one << 8))       { packer.push(fmt8);  pack8(size); }
-  else if (size < (one << 16)) { packer.push(fmt16); pack16(size); }
-  else if (size < (one << 32)) { packer.push(fmt32); pack32(size); }
+  const size_t size = std::ranges::size(value);
+  if (size < (one << 8))       pack_tagged<uint8_t>(packer, fmt8, size);
+  else if (size < (one << 16)) pack_tagged<uint16_t>(packer, fmt16, size);
+  else if (size < (one << 32)) pack_tagged<uint32_t>(packer, fmt32, size);
   else                         throw;  // don't do it
 
-  for (const Byte b : value) packer.push(static_cast<uint8_t>(b));
+  write_bytes(packer, value);
 }
 
-template <std::ranges::range T, std::byte fmt8, std::byte fmt16, std::byte fmt32>
-requires byte_like<std::ranges::range_value_t<T>>
-std::optional<T> unpack_bytes(Unpacker &unpacker, const std::function<T(const size_t)> &read) {
-  using Byte = std::ranges::range_value_t<T>;
-  auto read8 = [&]() { return std::to_integer<uint64_t>(unpacker.read()); };
-  auto read16 = [&]() { return (read8()  <<  8) | read8(); };
-  auto read32 = [&]() { return (read16() << 16) | read16(); };
+// size of the 8/16/32-bit length header plus the payload
+constexpr size_t packed_bytes_size(const size_t size) {
+  constexpr uint64_t one = 1;
+  if      (size < (one << 8))  return 2 + size;
+  else if (size < (one << 16)) return 3 + size;
+  else                         return 5 + size;
+}
 
-  const std::byte first_byte = $expect_read();
-  switch (first_byte) {
-    case fmt8:  { $expect(unpacker.size() >= 1); return read(static_cast<size_t>(read8())); }
-    case fmt16: { $expect(unpacker.size() >= 2); return read(static_cast<size_t>(read16())); }
-    case fmt32: { $expect(unpacker.size() >= 4); return read(static_cast<size_t>(read32())); }
-    default: $fail();
-  }
+// payload of a str or bin
+template <Type type, class Policy>
+std::optional<BufferView> unpack_bytes(BasicUnpacker<Policy> &unpacker) {
+  const Lead lead = $unwrap(unpack_lead(unpacker, type));
+  const uint64_t size = $unwrap(unpack_length(unpacker, lead));
+  return unpacker.read_span(size);
 }
 
+template <class Policy>
+std::optional<BufferView> unpack_str(BasicUnpacker<Policy> &unpacker) { return unpack_bytes<Type::str>(unpacker); }
+
 }
 
 // str
-define_pack(std::string) {
+define_constexpr_pack(std::string_view) {
   const size_t size = value.size();
-  if (size >= (1 << 5)) return detail::pack_bytes<std::string, format::str_8, format::str_16, format::str_32>(packer, value);
+  if (size >= (1 << 5)) return detail::pack_bytes<std::string_view, format::str_8, format::str_16, format::str_32>(packer, value);
 
-  packer.push(0b10100000 | size);
-  for (const char c : value) packer.push(static_cast<uint8_t>(c));
+  detail::push_format(packer, format::fixstr | static_cast<std::byte>(size));
+  detail::write_bytes(packer, value);
 }
 
-define_unpack(std::string) {
-  auto read = [&](const size_t size) {
-    std::string s; s.reserve(size);
-    for (size_t i = 0; i < size; i++) s.push_back(static_cast<char>(unpacker.read()));
-    return s;
-  };
+// borrows from the unpacker's buffer, which has to outlive the result
+define_unpack(std::string_view) {
+  const BufferView bytes = $unwrap(detail::unpack_str(unpacker));
+  return std::string_view(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+template<> constexpr size_t msgpack::impl<std::string_view>::packed_size(const std::string_view &value) {
+  const size_t size = value.size();
+  return size < (1 << 5) ? 1 + size : detail::packed_bytes_size(size);
+}
+define_packed_size_bounds(std::string_view, 1, unbounded);
+template<> inline constexpr bool msgpack::has_packed_size<std::string_view> = true;
+
+namespace msgpack {
+
+template <class Alloc>
+struct impl<std::basic_string<char, std::char_traits<char>, Alloc>> {
+  using String = std::basic_string<char, std::char_traits<char>, Alloc>;
+
+  static void pack(Packer &packer, const String &value) { pack_one<std::string_view>(packer, value); }
+
+  template <class Policy>
+  static std::optional<String> unpack(BasicUnpacker<Policy> &unpacker) {
+    String value = detail::construct<String>(unpacker);
+    $expect(unpack_into(unpacker, value));
+    return value;
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, String &value) {
+    const std::optional<std::string_view> view = unpack_one<std::string_view>(unpacker);
+    if (!view) return false;
+    if (view->size() > value.capacity()) detail::count_allocation();
+    value.assign(*view);
+    return true;
+  }
+
+  static size_t packed_size(const String &value) { return impl<std::string_view>::packed_size(value); }
+};
+
+template <class Alloc>
+inline constexpr size_t min_packed_size<std::basic_string<char, std::char_traits<char>, Alloc>> = 1;
+template <class Alloc>
+inline constexpr bool has_packed_size<std::basic_string<char, std::char_traits<char>, Alloc>> = true;
 
-  const std::byte first_byte = $expect_peek();
-  const uint8_t first_byte_value = std::to_integer<uint8_t>(first_byte);
-  if ((first_byte_value & 0b1010'0000) == 0b1010'0000) { $expect_read(); return read(first_byte_value & 0b0001'1111); }
-  return detail::unpack_bytes<std::string, format::str_8, format::str_16, format::str_32>(unpacker, read);
 }
 
+// interned str. without an interner to look it up in, it views the buffer like std::string_view
+define_pack(msgpack::interned) { pack_one(packer, value.view); }
+define_unpack(msgpack::interned) {
+  const std::string_view view = $unwrap(unpack_one<std::string_view>(unpacker));
+  if (Interner *interner = unpacker.interner()) return interner->intern(view);
+  return interned{interned::none, view};
+}
+template<> constexpr size_t msgpack::impl<msgpack::interned>::packed_size(const interned &value) { return impl<std::string_view>::packed_size(value.view); }
+define_packed_size_bounds(msgpack::interned, 1, unbounded);
+template<> inline constexpr bool msgpack::has_packed_size<msgpack::interned> = true;
+
+// borrowed bin, see std::string_view
+define_pack(std::span<const std::byte>) { return detail::pack_bytes<std::span<const std::byte>, format::bin_8, format::bin_16, format::bin_32>(packer, value); }
+define_unpack(std::span<const std::byte>) { return detail::unpack_bytes<Type::bin>(unpacker); }
+template<> constexpr size_t msgpack::impl<std::span<const std::byte>>::packed_size(const std::span<const std::byte> &value) { return detail::packed_bytes_size(value.size()); }
+define_packed_size_bounds(std::span<const std::byte>, 2, unbounded);
+template<> inline constexpr bool msgpack::has_packed_size<std::span<const std::byte>> = true;
+
+define_pack(std::span<const uint8_t>) { return detail::pack_bytes<std::span<const uint8_t>, format::bin_8, format::bin_16, format::bin_32>(packer, value); }
+define_unpack(std::span<const uint8_t>) {
+  const BufferView bytes = $unwrap((detail::unpack_bytes<Type::bin>(unpacker)));
+  return std::span(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+}
+template<> constexpr size_t msgpack::impl<std::span<const uint8_t>>::packed_size(const std::span<const uint8_t> &value) { return detail::packed_bytes_size(value.size()); }
+define_packed_size_bounds(std::span<const uint8_t>, 2, unbounded);
+template<> inline constexpr bool msgpack::has_packed_size<std::span<const uint8_t>> = true;
+
+namespace msgpack {
+
 // bin
-define_pack(std::vector<uint8_t>) { return detail::pack_bytes<std::vector<uint8_t>, format::bin_8, format::bin_16, format::bin_32>(packer, value); }
+template <class Alloc>
+struct impl<std::vector<uint8_t, Alloc>> {
+  using Bytes = std::vector<uint8_t, Alloc>;
 
-define_unpack(std::vector<uint8_t>) {
-  auto read = [&](const size_t size) {
-    std::vector<uint8_t> b; b.reserve(size);
-    for (size_t i = 0; i < size; i++) b.push_back(static_cast<uint8_t>(unpacker.read()));
-    return b;
-  };
+  static void pack(Packer &packer, const Bytes &value) { detail::pack_bytes<Bytes, format::bin_8, format::bin_16, format::bin_32>(packer, value); }
+
+  template <class Policy>
+  static std::optional<Bytes> unpack(BasicUnpacker<Policy> &unpacker) {
+    Bytes value = detail::construct<Bytes>(unpacker);
+    $expect(unpack_into(unpacker, value));
+    return value;
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, Bytes &value) {
+    const std::optional<std::span<const uint8_t>> bytes = unpack_one<std::span<const uint8_t>>(unpacker);
+    if (!bytes) return false;
+    if (bytes->size() > value.capacity()) detail::count_allocation();
+    value.assign(bytes->begin(), bytes->end());
+    return true;
+  }
+
+  static size_t packed_size(const Bytes &value) { return detail::packed_bytes_size(value.size()); }
+};
+
+template <class Alloc>
+inline constexpr size_t min_packed_size<std::vector<uint8_t, Alloc>> = 2;
+template <class Alloc>
+inline constexpr bool has_packed_size<std::vector<uint8_t, Alloc>> = true;
+
+}
+
+// bulk kernels for arrays of fixed-size records, each a format byte followed by a big-endian value
+// (float_32, float_64, and full-width ints). picked at startup from what the cpu supports
+namespace msgpack::detail {
+
+// writes n records of format fmt from n native values of the kernel's width
+using encode_kernel = void (*)(std::byte *out, const void *in, size_t n, std::byte fmt);
+// reads n records into native values, false if any of them has a format other than fmt
+using decode_kernel = bool (*)(void *out, const std::byte *in, size_t n, std::byte fmt);
+
+struct Kernels {
+  const char *name;
+  encode_kernel encode8, encode16, encode32, encode64;
+  decode_kernel decode8, decode16, decode32, decode64;
+
+  template <size_t Width> encode_kernel encode() const {
+    if constexpr (Width == 1) return encode8;
+    else if constexpr (Width == 2) return encode16;
+    else if constexpr (Width == 4) return encode32;
+    else return encode64;
+  }
+
+  template <size_t Width> decode_kernel decode() const {
+    if constexpr (Width == 1) return decode8;
+    else if constexpr (Width == 2) return decode16;
+    else if constexpr (Width == 4) return decode32;
+    else return decode64;
+  }
+};
+
+template <std::unsigned_integral U>
+void encode_scalar(std::byte *out, const void *in, const size_t n, const std::byte fmt) {
+  const std::byte *src = static_cast<const std::byte *>(in);
+  for (size_t i = 0; i < n; i++, src += sizeof(U), out += 1 + sizeof(U)) {
+    U value;
+    std::memcpy(&value, src, sizeof(U));
+    value = big_endian(value);
+    out[0] = fmt;
+    std::memcpy(out + 1, &value, sizeof(U));
+  }
+}
+
+template <std::unsigned_integral U>
+bool decode_scalar(void *out, const std::byte *in, const size_t n, const std::byte fmt) {
+  std::byte *dst = static_cast<std::byte *>(out);
+  bool ok = true;
+  for (size_t i = 0; i < n; i++, dst += sizeof(U), in += 1 + sizeof(U)) {
+    ok &= in[0] == fmt;
+    const U value = load_big_endian<U>(in + 1);
+    std::memcpy(dst, &value, sizeof(U));
+  }
+  return ok;
+}
+
+inline constexpr Kernels scalar_kernels{
+  "scalar",
+  encode_scalar<uint8_t>, encode_scalar<uint16_t>, encode_scalar<uint32_t>, encode_scalar<uint64_t>,
+  decode_scalar<uint8_t>, decode_scalar<uint16_t>, decode_scalar<uint32_t>, decode_scalar<uint64_t>,
+};
+
+#ifdef MPACK_X86_KERNELS
+
+// 4 x 32-bit -> 20 bytes: two overlapping 16-byte stores, at +0 and +4
+#define MPACK_ENCODE32_MASKS                                                              \
+  const char f = static_cast<char>(fmt);                                                  \
+  const __m128i m0 = _mm_setr_epi8(-1, 3, 2, 1, 0, -1, 7, 6, 5, 4, -1, 11, 10, 9, 8, -1); \
+  const __m128i t0 = _mm_setr_epi8(f, 0, 0, 0, 0, f, 0, 0, 0, 0, f, 0, 0, 0, 0, f);       \
+  const __m128i m1 = _mm_setr_epi8(0, -1, 7, 6, 5, 4, -1, 11, 10, 9, 8, -1, 15, 14, 13, 12); \
+  const __m128i t1 = _mm_setr_epi8(0, f, 0, 0, 0, 0, f, 0, 0, 0, 0, f, 0, 0, 0, 0)
+
+// 4 records -> 4 x 32-bit: loads at +0 and +4, formats at 0/5/10/15 of the first
+#define MPACK_DECODE32_MASKS                                                                     \
+  const __m128i m0 = _mm_setr_epi8(4, 3, 2, 1, 9, 8, 7, 6, 14, 13, 12, 11, -1, -1, -1, -1);      \
+  const __m128i m1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, 14, 13, 12); \
+  constexpr int tags = 0x8421
+
+// 2 x 64-bit -> 18 bytes: overlapping stores at +0 and +2
+#define MPACK_ENCODE64_MASKS                                                               \
+  const char f = static_cast<char>(fmt);                                                   \
+  const __m128i m0 = _mm_setr_epi8(-1, 7, 6, 5, 4, 3, 2, 1, 0, -1, 15, 14, 13, 12, 11, 10); \
+  const __m128i t0 = _mm_setr_epi8(f, 0, 0, 0, 0, 0, 0, 0, 0, f, 0, 0, 0, 0, 0, 0);        \
+  const __m128i m1 = _mm_setr_epi8(6, 5, 4, 3, 2, 1, 0, -1, 15, 14, 13, 12, 11, 10, 9, 8);  \
+  const __m128i t1 = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, f, 0, 0, 0, 0, 0, 0, 0, 0)
+
+// 2 records -> 2 x 64-bit: loads at +0 and +2, formats at 0/9 of the first
+#define MPACK_DECODE64_MASKS                                                                       \
+  const __m128i m0 = _mm_setr_epi8(8, 7, 6, 5, 4, 3, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1);        \
+  const __m128i m1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 15, 14, 13, 12, 11, 10, 9, 8);  \
+  constexpr int tags = 0x0201
+
+__attribute__((target("ssse3")))
+inline void encode32_ssse3(std::byte *out, const void *in, const size_t n, const std::byte fmt) {
+  MPACK_ENCODE32_MASKS;
+  const std::byte *src = static_cast<const std::byte *>(in);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4, src += 16, out += 20) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_or_si128(_mm_shuffle_epi8(v, m0), t0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4), _mm_or_si128(_mm_shuffle_epi8(v, m1), t1));
+  }
+  encode_scalar<uint32_t>(out, src, n - i, fmt);
+}
+
+__attribute__((target("ssse3")))
+inline bool decode32_ssse3(void *out, const std::byte *in, const size_t n, const std::byte fmt) {
+  MPACK_DECODE32_MASKS;
+  const __m128i f = _mm_set1_epi8(static_cast<char>(fmt));
+  std::byte *dst = static_cast<std::byte *>(out);
+  int ok = tags;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4, dst += 16, in += 20) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 4));
+    ok &= _mm_movemask_epi8(_mm_cmpeq_epi8(x, f));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_shuffle_epi8(x, m0), _mm_shuffle_epi8(y, m1)));
+  }
+  return (ok == tags) & decode_scalar<uint32_t>(dst, in, n - i, fmt);
+}
+
+__attribute__((target("ssse3")))
+inline void encode64_ssse3(std::byte *out, const void *in, const size_t n, const std::byte fmt) {
+  MPACK_ENCODE64_MASKS;
+  const std::byte *src = static_cast<const std::byte *>(in);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2, src += 16, out += 18) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_or_si128(_mm_shuffle_epi8(v, m0), t0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2), _mm_or_si128(_mm_shuffle_epi8(v, m1), t1));
+  }
+  encode_scalar<uint64_t>(out, src, n - i, fmt);
+}
+
+__attribute__((target("ssse3")))
+inline bool decode64_ssse3(void *out, const std::byte *in, const size_t n, const std::byte fmt) {
+  MPACK_DECODE64_MASKS;
+  const __m128i f = _mm_set1_epi8(static_cast<char>(fmt));
+  std::byte *dst = static_cast<std::byte *>(out);
+  int ok = tags;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2, dst += 16, in += 18) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2));
+    ok &= _mm_movemask_epi8(_mm_cmpeq_epi8(x, f));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_shuffle_epi8(x, m0), _mm_shuffle_epi8(y, m1)));
+  }
+  return (ok == tags) & decode_scalar<uint64_t>(dst, in, n - i, fmt);
+}
+
+// the avx2 versions do two of the above per iteration, one per 128-bit lane
+
+__attribute__((target("avx2")))
+inline __m256i load_lanes(const std::byte *lo, const std::byte *hi) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lo))),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)), 1);
+}
+
+__attribute__((target("avx2")))
+inline void store_lanes(std::byte *lo, std::byte *hi, const __m256i v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lo), _mm256_castsi256_si128(v));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(hi), _mm256_extracti128_si256(v, 1));
+}
+
+__attribute__((target("avx2")))
+inline void encode32_avx2(std::byte *out, const void *in, const size_t n, const std::byte fmt) {
+  MPACK_ENCODE32_MASKS;
+  const __m256i m0x2 = _mm256_broadcastsi128_si256(m0), t0x2 = _mm256_broadcastsi128_si256(t0);
+  const __m256i m1x2 = _mm256_broadcastsi128_si256(m1), t1x2 = _mm256_broadcastsi128_si256(t1);
+  const std::byte *src = static_cast<const std::byte *>(in);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8, src += 32, out += 40) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    store_lanes(out, out + 20, _mm256_or_si256(_mm256_shuffle_epi8(v, m0x2), t0x2));
+    store_lanes(out + 4, out + 24, _mm256_or_si256(_mm256_shuffle_epi8(v, m1x2), t1x2));
+  }
+  encode32_ssse3(out, src, n - i, fmt);
+}
+
+__attribute__((target("avx2")))
+inline bool decode32_avx2(void *out, const std::byte *in, const size_t n, const std::byte fmt) {
+  MPACK_DECODE32_MASKS;
+  const __m256i m0x2 = _mm256_broadcastsi128_si256(m0), m1x2 = _mm256_broadcastsi128_si256(m1);
+  const __m256i f = _mm256_set1_epi8(static_cast<char>(fmt));
+  constexpr uint32_t tags_x2 = tags | (tags << 16);
+  std::byte *dst = static_cast<std::byte *>(out);
+  uint32_t ok = tags_x2;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8, dst += 32, in += 40) {
+    const __m256i x = load_lanes(in, in + 20);
+    const __m256i y = load_lanes(in + 4, in + 24);
+    ok &= static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, f)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_or_si256(_mm256_shuffle_epi8(x, m0x2), _mm256_shuffle_epi8(y, m1x2)));
+  }
+  return (ok == tags_x2) & decode32_ssse3(dst, in, n - i, fmt);
+}
+
+__attribute__((target("avx2")))
+inline void encode64_avx2(std::byte *out, const void *in, const size_t n, const std::byte fmt) {
+  MPACK_ENCODE64_MASKS;
+  const __m256i m0x2 = _mm256_broadcastsi128_si256(m0), t0x2 = _mm256_broadcastsi128_si256(t0);
+  const __m256i m1x2 = _mm256_broadcastsi128_si256(m1), t1x2 = _mm256_broadcastsi128_si256(t1);
+  const std::byte *src = static_cast<const std::byte *>(in);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4, src += 32, out += 36) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    store_lanes(out, out + 18, _mm256_or_si256(_mm256_shuffle_epi8(v, m0x2), t0x2));
+    store_lanes(out + 2, out + 20, _mm256_or_si256(_mm256_shuffle_epi8(v, m1x2), t1x2));
+  }
+  encode64_ssse3(out, src, n - i, fmt);
+}
+
+__attribute__((target("avx2")))
+inline bool decode64_avx2(void *out, const std::byte *in, const size_t n, const std::byte fmt) {
+  MPACK_DECODE64_MASKS;
+  const __m256i m0x2 = _mm256_broadcastsi128_si256(m0), m1x2 = _mm256_broadcastsi128_si256(m1);
+  const __m256i f = _mm256_set1_epi8(static_cast<char>(fmt));
+  constexpr uint32_t tags_x2 = tags | (tags << 16);
+  std::byte *dst = static_cast<std::byte *>(out);
+  uint32_t ok = tags_x2;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4, dst += 32, in += 36) {
+    const __m256i x = load_lanes(in, in + 18);
+    const __m256i y = load_lanes(in + 2, in + 20);
+    ok &= static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, f)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_or_si256(_mm256_shuffle_epi8(x, m0x2), _mm256_shuffle_epi8(y, m1x2)));
+  }
+  return (ok == tags_x2) & decode64_ssse3(dst, in, n - i, fmt);
+}
+
+#undef MPACK_ENCODE32_MASKS
+#undef MPACK_DECODE32_MASKS
+#undef MPACK_ENCODE64_MASKS
+#undef MPACK_DECODE64_MASKS
+
+inline constexpr Kernels ssse3_kernels{
+  "ssse3",
+  encode_scalar<uint8_t>, encode_scalar<uint16_t>, encode32_ssse3, encode64_ssse3,
+  decode_scalar<uint8_t>, decode_scalar<uint16_t>, decode32_ssse3, decode64_ssse3,
+};
+
+inline constexpr Kernels avx2_kernels{
+  "avx2",
+  encode_scalar<uint8_t>, encode_scalar<uint16_t>, encode32_avx2, encode64_avx2,
+  decode_scalar<uint8_t>, decode_scalar<uint16_t>, decode32_avx2, decode64_avx2,
+};
+
+#endif
+
+// every kernel set this cpu can run, best last
+inline std::vector<const Kernels *> supported_kernels() {
+  std::vector<const Kernels *> supported{&scalar_kernels};
+#ifdef MPACK_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) supported.push_back(&ssse3_kernels);
+  if (__builtin_cpu_supports("avx2")) supported.push_back(&avx2_kernels);
+#endif
+  return supported;
+}
+
+// the set in use, picked on first use rather than by a static initializer, which another
+// translation unit's could otherwise run ahead of. not meant to be changed outside of tests and
+// benchmarks
+inline const Kernels *&kernels() {
+  static const Kernels *selected = supported_kernels().back();
+  return selected;
+}
+
+}
+
+// array and map
+namespace msgpack::detail {
+
+template <std::byte fix, std::byte fmt16, std::byte fmt32>
+constexpr void pack_container_header(Packer &packer, const size_t size) {
+  constexpr uint64_t one = 1;
+  if (size < 16)               push_format(packer, fix | static_cast<std::byte>(size));
+  else if (size < (one << 16)) pack_tagged<uint16_t>(packer, fmt16, size);
+  else if (size < (one << 32)) pack_tagged<uint32_t>(packer, fmt32, size);
+  else                         throw;  // don't do it
+}
+
+template <Type type, class Policy>
+std::optional<size_t> unpack_container_header(BasicUnpacker<Policy> &unpacker) {
+  const Lead lead = $unwrap(unpack_lead(unpacker, type));
+  return unpack_length(unpacker, lead);
+}
+
+constexpr size_t container_header_size(const size_t size) {
+  constexpr uint64_t one = 1;
+  return size < 16 ? 1 : size < (one << 16) ? 3 : 5;
+}
+
+constexpr void pack_array_header(Packer &packer, const size_t size) { pack_container_header<format::fixarray, format::array_16, format::array_32>(packer, size); }
+constexpr void pack_map_header(Packer &packer, const size_t size) { pack_container_header<format::fixmap, format::map_16, format::map_32>(packer, size); }
+template <class Policy>
+std::optional<size_t> unpack_array_header(BasicUnpacker<Policy> &unpacker) { return unpack_container_header<Type::array>(unpacker); }
+template <class Policy>
+std::optional<size_t> unpack_map_header(BasicUnpacker<Policy> &unpacker) { return unpack_container_header<Type::map>(unpacker); }
+
+// elements that always pack to the same format, so a whole array body is one fixed-stride block
+// that gets encoded into one window and decoded out of one span
+template <class T>
+concept bulk_element = std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+template <bulk_element T> constexpr std::byte bulk_format = std::is_same_v<T, float> ? format::float_32 : format::float_64;
+
+template <std::integral T>
+constexpr std::byte full_width_format = std::is_signed_v<T>
+  ? (sizeof(T) == 1 ? format::int_8 : sizeof(T) == 2 ? format::int_16 : sizeof(T) == 4 ? format::int_32 : format::int_64)
+  : (sizeof(T) == 1 ? format::uint_8 : sizeof(T) == 2 ? format::uint_16 : sizeof(T) == 4 ? format::uint_32 : format::uint_64);
+
+// types that always pack to exactly raw<T>::size bytes, which raw<T>::put() writes straight into
+// memory and raw<T>::get() reads back, checking format bytes but not bounds. the caller checks
+// those once for a whole record or array. specialized further down
+template <class T> struct raw {};
+
+template <class T>
+concept raw_encodable = requires { raw<T>::size; };
+
+template <size_t N>
+void put_array_header(std::byte *out) {
+  if constexpr (container_header_size(N) == 1)      out[0] = format::fixarray | static_cast<std::byte>(N);
+  else if constexpr (container_header_size(N) == 3) { out[0] = format::array_16; store_big_endian<uint16_t>(out + 1, N); }
+  else                                              { out[0] = format::array_32; store_big_endian<uint32_t>(out + 1, N); }
+}
+
+// an element of an array or map, or either half of a pair, has to be one value, so a T that packs
+// to several (an aggregate of more than one field, a define_pack() with more than one do_pack())
+// is packed there as an array of those values. static_values() is how many that is where the type
+// alone says, which is one for everything defined here and the sum over the fields of an aggregate
+template <class T>
+constexpr std::optional<size_t> static_values() {
+  if constexpr (requires { impl<T>::values; }) return impl<T>::values;
+  else return 1;
+}
+
+template <class T> std::optional<size_t> packed_values();
+
+// and otherwise what a default-constructed T packs to, so a define_pack() type has to pack to as
+// many values whatever it holds
+template <class T>
+constexpr size_t element_values() {
+  if constexpr (static_values<T>().has_value()) return *static_values<T>();
+  else {
+    static_assert(std::is_default_constructible_v<T>, "a define_pack() type in an array or map has to be default-constructible, to count what it packs to");
+    return *packed_values<T>();
+  }
+}
+
+template <class T>
+constexpr size_t element_header_size() {
+  const size_t count = element_values<T>();
+  return count == 1 ? 0 : container_header_size(count);
+}
+
+// bounds on element_header_size<T>() at compile time
+template <class T> inline constexpr size_t min_element_header_size = static_values<T>() ? element_header_size<T>() : 0;
+template <class T> inline constexpr size_t max_element_header_size = static_values<T>() ? element_header_size<T>() : 5;
+
+template <class T>
+constexpr void pack_element(Packer &packer, const T &value) {
+  if (const size_t count = element_values<T>(); count != 1) pack_array_header(packer, count);
+  pack_one(packer, value);
+}
+
+template <class T, class Policy>
+bool unpack_element_header(BasicUnpacker<Policy> &unpacker) {
+  const size_t count = element_values<T>();
+  if (count == 1) return true;
+  const std::optional<size_t> size = unpack_array_header(unpacker);
+  if (size && *size != count) unpacker.fail(Errc::type_mismatch);
+  return size == count;
+}
+
+template <class T, class Policy>
+std::optional<T> unpack_element(BasicUnpacker<Policy> &unpacker) {
+  if (!unpack_element_header<T>(unpacker)) return std::nullopt;
+  return unpack_one<T>(unpacker);
+}
+
+template <class T, class Policy>
+bool unpack_element_into(BasicUnpacker<Policy> &unpacker, T &value) {
+  return unpack_element_header<T>(unpacker) && unpack_one_into(unpacker, value);
+}
+
+template <class T>
+constexpr size_t packed_element_size(const T &value) { return element_header_size<T>() + impl<T>::packed_size(value); }
+
+// raw<T> as an element, behind its array header if it has one
+template <class T>
+struct raw_element {
+  static constexpr size_t header = element_header_size<T>();
+  static constexpr size_t size = header + raw<T>::size;
+
+  static void put(std::byte *out, const T &value) {
+    if constexpr (header) put_array_header<element_values<T>()>(out);
+    raw<T>::put(out + header, value);
+  }
+
+  static bool get(const std::byte *in, T &value) {
+    if constexpr (header) {
+      std::array<std::byte, header> expected;
+      put_array_header<element_values<T>()>(expected.data());
+      if (std::memcmp(in, expected.data(), header) != 0) return false;
+    }
+    return raw<T>::get(in + header, value);
+  }
+};
+
+template <class T>
+void pack_array_body(Packer &packer, const std::span<const T> values) {
+  if constexpr (bulk_element<T>) {
+    constexpr size_t stride = 1 + sizeof(T);
+    if (std::byte *out = packer.claim(stride * values.size())) {
+      kernels()->encode<sizeof(T)>()(out, values.data(), values.size(), bulk_format<T>);
+      packer.advance(stride * values.size());
+      count_packed(packer, bulk_format<T>, values.size());
+      return;
+    }
+  } else if constexpr (raw_encodable<T>) {
+    if (std::byte *out = packer.claim(raw_element<T>::size * values.size())) {
+      for (size_t i = 0; i < values.size(); i++) raw_element<T>::put(out + i * raw_element<T>::size, values[i]);
+      packer.advance(raw_element<T>::size * values.size());
+      count_packed(packer, BufferView(out, raw_element<T>::size * values.size()));
+      return;
+    }
+  }
+  for (const T &value : values) pack_element(packer, value);
+}
+
+// the bulk paths size their reads by stride rather than by what's actually there, so they check
+// bounds even under policy::trusted
+template <class T, class Policy>
+bool unpack_array_body(BasicUnpacker<Policy> &unpacker, const std::span<T> values) {
+  if constexpr (bulk_element<T>) {
+    constexpr size_t stride = 1 + sizeof(T);
+    if (!unpacker.check(stride * values.size())) return false;
+    const BufferView bytes = *unpacker.read_span(stride * values.size());
+    if (kernels()->decode<sizeof(T)>()(values.data(), bytes.data(), values.size(), bulk_format<T>)) {
+      count_unpacked(bulk_format<T>, values.size());
+      return true;
+    }
+    unpacker.fail(Errc::type_mismatch, unpacker.offset() - bytes.size());
+    return false;
+  } else {
+    // full-width ints (see fixed_width) have a fixed stride too, try that before going one by one
+    if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+      constexpr size_t stride = 1 + sizeof(T);
+      const std::optional<BufferView> bytes = unpacker.peek_span(stride * values.size());
+      if (bytes && !values.empty() && (*bytes)[0] == full_width_format<T> &&
+          kernels()->decode<sizeof(T)>()(values.data(), bytes->data(), values.size(), full_width_format<T>)) {
+        count_unpacked(full_width_format<T>, values.size());
+        return unpacker.read_span(stride * values.size()).has_value();
+      }
+    }
+    if constexpr (raw_encodable<T>) {
+      const std::optional<BufferView> bytes = unpacker.peek_span(raw_element<T>::size * values.size());
+      bool ok = bytes.has_value();
+      for (size_t i = 0; ok && i < values.size(); i++) ok = raw_element<T>::get(bytes->data() + i * raw_element<T>::size, values[i]);
+      if (ok) {
+        count_unpacked(*bytes);
+        return unpacker.read_span(bytes->size()).has_value();
+      }
+    }
+    for (T &value : values) {
+      if (!unpack_element_into(unpacker, value)) return false;
+    }
+    return true;
+  }
+}
+
+template <class T>
+size_t packed_array_body_size(const std::span<const T> values) {
+  if constexpr (fixed_size<T>) return values.size() * (element_header_size<T>() + max_packed_size<T>);
+  size_t size = 0;
+  for (const T &value : values) size += packed_element_size(value);
+  return size;
+}
+
+template <class Map>
+struct map_impl {
+  using K = typename Map::key_type;
+  using V = typename Map::mapped_type;
+
+  static void pack(Packer &packer, const Map &value) {
+    pack_map_header(packer, value.size());
+    for (const auto &[k, v] : value) { pack_element(packer, k); pack_element(packer, v); }
+  }
+
+  template <class Policy>
+  static std::optional<Map> unpack(BasicUnpacker<Policy> &unpacker) {
+    Map map = construct<Map>(unpacker);
+    $expect(unpack_into(unpacker, map));
+    return map;
+  }
+
+  // the nodes of the entries already there are recycled, keys and values unpacked into, so a
+  // std::map doesn't allocate for as many entries as it held last time. any nodes left over are
+  // freed. an unordered_map still allocates its bucket array each time
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, Map &map) {
+    const std::optional<size_t> size = unpack_map_header(unpacker);
+    if (!size || !unpacker.has(2 * *size)) return false;
+    Map old = std::move(map);
+    map.clear();
+    for (size_t i = 0; i < *size; i++) {
+      bool inserted;
+      if (old.empty()) {
+        count_allocation();
+        std::optional<K> k = unpack_element<K>(unpacker);
+        std::optional<V> v = k ? unpack_element<V>(unpacker) : std::nullopt;
+        if (!v) return false;
+        inserted = map.try_emplace(std::move(*k), std::move(*v)).second;
+      } else {
+        typename Map::node_type node = old.extract(old.begin());
+        if (!unpack_element_into(unpacker, node.key()) || !unpack_element_into(unpacker, node.mapped())) return false;
+        inserted = map.insert(std::move(node)).inserted;
+      }
+      // duplicate keys are rejected rather than silently dropped
+      if (!inserted) {
+        unpacker.fail(Errc::duplicate_key);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static size_t packed_size(const Map &value) {
+    size_t size = container_header_size(value.size());
+    for (const auto &[k, v] : value) size += packed_element_size(k) + packed_element_size(v);
+    return size;
+  }
+};
+
+}
+
+namespace msgpack {
+
+// std::vector<uint8_t> is bin, not array
+template <class T, class Alloc>
+requires (!std::is_same_v<T, uint8_t>)
+struct impl<std::vector<T, Alloc>> {
+  static void pack(Packer &packer, const std::vector<T, Alloc> &value) {
+    detail::pack_array_header(packer, value.size());
+    if constexpr (std::is_same_v<T, bool>) for (const bool b : value) pack_one(packer, b);
+    else detail::pack_array_body<T>(packer, value);
+  }
+
+  template <class Policy>
+  static std::optional<std::vector<T, Alloc>> unpack(BasicUnpacker<Policy> &unpacker) {
+    std::vector<T, Alloc> vector = detail::construct<std::vector<T, Alloc>>(unpacker);
+    $expect(unpack_into(unpacker, vector));
+    return vector;
+  }
+
+  // elements that are already there are unpacked into, and those past the new size destroyed
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, std::vector<T, Alloc> &vector) {
+    const std::optional<size_t> size = detail::unpack_array_header(unpacker);
+    // every element is at least a byte, which keeps a bogus length from allocating the world
+    if (!size || !unpacker.has(*size)) return false;
+    if (*size > vector.capacity()) detail::count_allocation();
+    if constexpr (std::is_same_v<T, bool> || !std::is_default_constructible_v<T>) {
+      vector.clear();
+      vector.reserve(*size);
+      for (size_t i = 0; i < *size; i++) {
+        std::optional<T> element = detail::unpack_element<T>(unpacker);
+        if (!element) return false;
+        vector.push_back(std::move(*element));
+      }
+      return true;
+    } else {
+      if constexpr (std::is_trivially_default_constructible_v<T>) {
+        vector.resize(*size);
+      } else {
+        // new elements one by one, so that they get the unpacker's memory resource
+        if (vector.size() > *size) vector.resize(*size);
+        vector.reserve(*size);
+        while (vector.size() < *size) vector.push_back(detail::construct<T>(unpacker));
+      }
+      return detail::unpack_array_body<T>(unpacker, vector);
+    }
+  }
+
+  static size_t packed_size(const std::vector<T, Alloc> &value) {
+    if constexpr (std::is_same_v<T, bool>) return detail::container_header_size(value.size()) + value.size();
+    else return detail::container_header_size(value.size()) + detail::packed_array_body_size<T>(value);
+  }
+};
+
+template <class T, class Alloc>
+requires (!std::is_same_v<T, uint8_t>)
+inline constexpr size_t min_packed_size<std::vector<T, Alloc>> = 1;
+template <class T, class Alloc>
+requires (!std::is_same_v<T, uint8_t>)
+inline constexpr bool has_packed_size<std::vector<T, Alloc>> = presizable<T>;
+
+template <class T, size_t N>
+struct impl<std::array<T, N>> {
+  static void pack(Packer &packer, const std::array<T, N> &value) {
+    detail::pack_array_header(packer, N);
+    detail::pack_array_body<T>(packer, value);
+  }
+
+  template <class Policy>
+  static std::optional<std::array<T, N>> unpack(BasicUnpacker<Policy> &unpacker) {
+    std::array<T, N> array = construct(unpacker);
+    $expect(unpack_into(unpacker, array));
+    return array;
+  }
+
+  template <class Policy>
+  static std::array<T, N> construct(BasicUnpacker<Policy> &unpacker) {
+    if constexpr (std::is_trivially_default_constructible_v<T>) return {};
+    else return [&]<size_t ...Is>(std::index_sequence<Is...>) {
+      return std::array<T, N>{(void(Is), detail::construct<T>(unpacker))...};
+    }(std::make_index_sequence<N>{});
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, std::array<T, N> &array) {
+    const std::optional<size_t> size = detail::unpack_array_header(unpacker);
+    if (size && *size != N) unpacker.fail(Errc::type_mismatch);
+    return size == N && detail::unpack_array_body<T>(unpacker, std::span<T>(array));
+  }
+
+  static constexpr size_t packed_size(const std::array<T, N> &value) {
+    return detail::container_header_size(N) + detail::packed_array_body_size<T>(value);
+  }
+};
+
+template <class T, size_t N>
+inline constexpr size_t min_packed_size<std::array<T, N>> = detail::container_header_size(N) + N * (detail::min_element_header_size<T> + min_packed_size<T>);
+template <class T, size_t N>
+inline constexpr size_t max_packed_size<std::array<T, N>> = max_packed_size<T> == unbounded ? unbounded : detail::container_header_size(N) + N * (detail::max_element_header_size<T> + max_packed_size<T>);
+template <class T, size_t N>
+inline constexpr bool has_packed_size<std::array<T, N>> = presizable<T>;
+
+// a 2-element array
+template <class A, class B>
+struct impl<std::pair<A, B>> {
+  static constexpr void pack(Packer &packer, const std::pair<A, B> &value) {
+    detail::push_format(packer, format::fixarray | std::byte{2});
+    detail::pack_element(packer, value.first);
+    detail::pack_element(packer, value.second);
+  }
+
+  template <class Policy>
+  static std::optional<std::pair<A, B>> unpack(BasicUnpacker<Policy> &unpacker) {
+    $expect_byte((format::fixarray | std::byte{2}));
+    A first = $unwrap(detail::unpack_element<A>(unpacker));
+    B second = $unwrap(detail::unpack_element<B>(unpacker));
+    return std::pair<A, B>(std::move(first), std::move(second));
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, std::pair<A, B> &value) {
+    return detail::expect_byte(unpacker, format::fixarray | std::byte{2}) &&
+           detail::unpack_element_into(unpacker, value.first) && detail::unpack_element_into(unpacker, value.second);
+  }
+
+  static constexpr size_t packed_size(const std::pair<A, B> &value) { return 1 + detail::packed_element_size(value.first) + detail::packed_element_size(value.second); }
+};
+
+template <class A, class B>
+inline constexpr size_t min_packed_size<std::pair<A, B>> = 1 + detail::min_element_header_size<A> + min_packed_size<A> + detail::min_element_header_size<B> + min_packed_size<B>;
+template <class A, class B>
+inline constexpr size_t max_packed_size<std::pair<A, B>> = max_packed_size<A> == unbounded || max_packed_size<B> == unbounded
+  ? unbounded : 1 + detail::max_element_header_size<A> + max_packed_size<A> + detail::max_element_header_size<B> + max_packed_size<B>;
+template <class A, class B>
+inline constexpr bool has_packed_size<std::pair<A, B>> = presizable<A> && presizable<B>;
+
+template <class K, class V, class Compare, class Alloc>
+struct impl<std::map<K, V, Compare, Alloc>> : detail::map_impl<std::map<K, V, Compare, Alloc>> {};
+template <class K, class V, class Compare, class Alloc>
+inline constexpr size_t min_packed_size<std::map<K, V, Compare, Alloc>> = 1;
+template <class K, class V, class Compare, class Alloc>
+inline constexpr bool has_packed_size<std::map<K, V, Compare, Alloc>> = presizable<K> && presizable<V>;
+
+template <class K, class V, class Hash, class Equal, class Alloc>
+struct impl<std::unordered_map<K, V, Hash, Equal, Alloc>> : detail::map_impl<std::unordered_map<K, V, Hash, Equal, Alloc>> {};
+template <class K, class V, class Hash, class Equal, class Alloc>
+inline constexpr size_t min_packed_size<std::unordered_map<K, V, Hash, Equal, Alloc>> = 1;
+template <class K, class V, class Hash, class Equal, class Alloc>
+inline constexpr bool has_packed_size<std::unordered_map<K, V, Hash, Equal, Alloc>> = presizable<K> && presizable<V>;
+
+}
+
+// fixed width
+namespace msgpack {
+
+// packs integers at the full width of their type (uint_32 for uint32_t and so on) rather than the
+// smallest format that fits. costs bytes for small values, but every element of an array then has
+// the same stride and goes through the bulk kernels both ways, and a record of such fields has a
+// layout that stays put from one message to the next (see patch()). unpacks from any width.
+// strings get a str_32 header whatever their length
+
+template <class T>
+struct fixed_width {
+  T value;
+  bool operator==(const fixed_width &) const = default;
+};
+
+template <std::integral T>
+requires (!std::is_same_v<T, bool>)
+struct impl<fixed_width<T>> {
+  static constexpr void pack(Packer &packer, const fixed_width<T> &value) {
+    detail::pack_tagged(packer, detail::full_width_format<T>, static_cast<std::make_unsigned_t<T>>(value.value));
+  }
+
+  template <class Policy>
+  static std::optional<fixed_width<T>> unpack(BasicUnpacker<Policy> &unpacker) { return fixed_width<T>{$unwrap(unpack_one<T>(unpacker))}; }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, fixed_width<T> &value) { return unpack_one_into(unpacker, value.value); }
+
+  static constexpr size_t packed_size(const fixed_width<T> &) { return 1 + sizeof(T); }
+};
+
+template <std::integral T>
+requires (!std::is_same_v<T, bool>)
+inline constexpr size_t min_packed_size<fixed_width<T>> = 1 + sizeof(T);
+template <std::integral T>
+requires (!std::is_same_v<T, bool>)
+inline constexpr size_t max_packed_size<fixed_width<T>> = 1 + sizeof(T);
+
+template <std::integral T, class Alloc>
+requires (!std::is_same_v<T, bool>)
+struct impl<fixed_width<std::vector<T, Alloc>>> {
+  static constexpr size_t stride = 1 + sizeof(T);
+
+  static void pack(Packer &packer, const fixed_width<std::vector<T, Alloc>> &value) {
+    const std::vector<T, Alloc> &values = value.value;
+    detail::pack_array_header(packer, values.size());
+    if (std::byte *out = packer.claim(stride * values.size())) {
+      detail::kernels()->encode<sizeof(T)>()(out, values.data(), values.size(), detail::full_width_format<T>);
+      packer.advance(stride * values.size());
+      detail::count_packed(packer, detail::full_width_format<T>, values.size());
+    } else {
+      for (const T element : values) pack_one(packer, fixed_width<T>{element});
+    }
+  }
+
+  template <class Policy>
+  static std::optional<fixed_width<std::vector<T, Alloc>>> unpack(BasicUnpacker<Policy> &unpacker) {
+    fixed_width<std::vector<T, Alloc>> value{detail::construct<std::vector<T, Alloc>>(unpacker)};
+    $expect(unpack_into(unpacker, value));
+    return value;
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, fixed_width<std::vector<T, Alloc>> &value) {
+    const std::optional<size_t> size = detail::unpack_array_header(unpacker);
+    if (!size || !unpacker.has(*size)) return false;
+    if (*size > value.value.capacity()) detail::count_allocation();
+    value.value.resize(*size);
+    return detail::unpack_array_body<T>(unpacker, value.value);
+  }
+
+  static size_t packed_size(const fixed_width<std::vector<T, Alloc>> &value) {
+    return detail::container_header_size(value.value.size()) + stride * value.value.size();
+  }
+};
+
+template <std::integral T, class Alloc>
+requires (!std::is_same_v<T, bool>)
+inline constexpr bool has_packed_size<fixed_width<std::vector<T, Alloc>>> = true;
+
+template <>
+struct impl<fixed_width<std::string_view>> {
+  static constexpr void pack(Packer &packer, const fixed_width<std::string_view> &value) {
+    detail::pack_tagged<uint32_t>(packer, format::str_32, value.value.size());
+    detail::write_bytes(packer, value.value);
+  }
+
+  template <class Policy>
+  static std::optional<fixed_width<std::string_view>> unpack(BasicUnpacker<Policy> &unpacker) { return fixed_width<std::string_view>{$unwrap(unpack_one<std::string_view>(unpacker))}; }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, fixed_width<std::string_view> &value) { return unpack_one_into(unpacker, value.value); }
+
+  static constexpr size_t packed_size(const fixed_width<std::string_view> &value) { return 5 + value.value.size(); }
+};
+
+template <>
+inline constexpr size_t min_packed_size<fixed_width<std::string_view>> = 5;
+template <>
+inline constexpr bool has_packed_size<fixed_width<std::string_view>> = true;
+
+template <class Alloc>
+struct impl<fixed_width<std::basic_string<char, std::char_traits<char>, Alloc>>> {
+  using String = std::basic_string<char, std::char_traits<char>, Alloc>;
+
+  static void pack(Packer &packer, const fixed_width<String> &value) { pack_one(packer, fixed_width<std::string_view>{value.value}); }
+
+  template <class Policy>
+  static std::optional<fixed_width<String>> unpack(BasicUnpacker<Policy> &unpacker) {
+    fixed_width<String> value{detail::construct<String>(unpacker)};
+    $expect(unpack_into(unpacker, value));
+    return value;
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, fixed_width<String> &value) { return unpack_one_into(unpacker, value.value); }
+
+  static size_t packed_size(const fixed_width<String> &value) { return 5 + value.value.size(); }
+};
+
+template <class Alloc>
+inline constexpr size_t min_packed_size<fixed_width<std::basic_string<char, std::char_traits<char>, Alloc>>> = 5;
+template <class Alloc>
+inline constexpr bool has_packed_size<fixed_width<std::basic_string<char, std::char_traits<char>, Alloc>>> = true;
+
+}
+
+// fixed-size encodings written in place (see detail::raw)
+namespace msgpack::detail {
+
+template <>
+struct raw<std::nullptr_t> {
+  static constexpr size_t size = 1;
+  static void put(std::byte *out, const std::nullptr_t &) { out[0] = format::nil; }
+  static bool get(const std::byte *in, std::nullptr_t &) { return in[0] == format::nil; }
+};
+
+template <>
+struct raw<bool> {
+  static constexpr size_t size = 1;
+  static void put(std::byte *out, const bool &value) { out[0] = value ? format::true_ : format::false_; }
+  static bool get(const std::byte *in, bool &value) {
+    value = in[0] == format::true_;
+    return value || in[0] == format::false_;
+  }
+};
+
+template <bulk_element T>
+struct raw<T> {
+  using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+  static constexpr size_t size = 1 + sizeof(T);
+  static void put(std::byte *out, const T &value) {
+    out[0] = bulk_format<T>;
+    store_big_endian(out + 1, std::bit_cast<U>(value));
+  }
+  static bool get(const std::byte *in, T &value) {
+    value = std::bit_cast<T>(load_big_endian<U>(in + 1));
+    return in[0] == bulk_format<T>;
+  }
+};
+
+template <std::integral T>
+requires (!std::is_same_v<T, bool>)
+struct raw<fixed_width<T>> {
+  using U = std::make_unsigned_t<T>;
+  static constexpr size_t size = 1 + sizeof(T);
+  static void put(std::byte *out, const fixed_width<T> &value) {
+    out[0] = full_width_format<T>;
+    store_big_endian(out + 1, static_cast<U>(value.value));
+  }
+  static bool get(const std::byte *in, fixed_width<T> &value) {
+    value.value = static_cast<T>(load_big_endian<U>(in + 1));
+    return in[0] == full_width_format<T>;
+  }
+};
+
+template <raw_encodable T, size_t N>
+struct raw<std::array<T, N>> {
+  static constexpr size_t header = container_header_size(N);
+  static constexpr size_t size = header + N * raw_element<T>::size;
+
+  static void put(std::byte *out, const std::array<T, N> &value) {
+    put_array_header<N>(out);
+    for (size_t i = 0; i < N; i++) raw_element<T>::put(out + header + i * raw_element<T>::size, value[i]);
+  }
+
+  static bool get(const std::byte *in, std::array<T, N> &value) {
+    std::array<std::byte, header> expected;
+    put_array_header<N>(expected.data());
+    bool ok = std::memcmp(in, expected.data(), header) == 0;
+    for (size_t i = 0; i < N; i++) ok &= raw_element<T>::get(in + header + i * raw_element<T>::size, value[i]);
+    return ok;
+  }
+};
+
+}
+
+// aggregates
+namespace msgpack::detail {
+
+// converts to anything, to count how many initializers an aggregate takes
+struct any_field {
+  template <class T> operator T() const;
+};
+
+inline constexpr size_t max_aggregate_fields = 16;
+
+template <class T, size_t ...Is>
+constexpr bool braces_with(std::index_sequence<Is...>) { return requires { T{(void(Is), any_field{})...}; }; }
+
+template <class T, size_t N = 0>
+constexpr size_t field_count() {
+  if constexpr (N == max_aggregate_fields + 1 || !braces_with<T>(std::make_index_sequence<N + 1>{})) return N;
+  else return field_count<T, N + 1>();
+}
+
+// calls fn with the fields of aggregate value, in order
+template <class T, class F>
+constexpr decltype(auto) with_fields(T &value, F &&fn) {
+  constexpr size_t count = field_count<std::remove_const_t<T>>();
+  static_assert(count >= 1 && count <= max_aggregate_fields, "define_aggregate() takes aggregates of 1 to 16 fields");
+  if constexpr (count == 1) { auto &[a] = value; return fn(a); }
+  else if constexpr (count == 2) { auto &[a, b] = value; return fn(a, b); }
+  else if constexpr (count == 3) { auto &[a, b, c] = value; return fn(a, b, c); }
+  else if constexpr (count == 4) { auto &[a, b, c, d] = value; return fn(a, b, c, d); }
+  else if constexpr (count == 5) { auto &[a, b, c, d, e] = value; return fn(a, b, c, d, e); }
+  else if constexpr (count == 6) { auto &[a, b, c, d, e, f] = value; return fn(a, b, c, d, e, f); }
+  else if constexpr (count == 7) { auto &[a, b, c, d, e, f, g] = value; return fn(a, b, c, d, e, f, g); }
+  else if constexpr (count == 8) { auto &[a, b, c, d, e, f, g, h] = value; return fn(a, b, c, d, e, f, g, h); }
+  else if constexpr (count == 9) { auto &[a, b, c, d, e, f, g, h, i] = value; return fn(a, b, c, d, e, f, g, h, i); }
+  else if constexpr (count == 10) { auto &[a, b, c, d, e, f, g, h, i, j] = value; return fn(a, b, c, d, e, f, g, h, i, j); }
+  else if constexpr (count == 11) { auto &[a, b, c, d, e, f, g, h, i, j, k] = value; return fn(a, b, c, d, e, f, g, h, i, j, k); }
+  else if constexpr (count == 12) { auto &[a, b, c, d, e, f, g, h, i, j, k, l] = value; return fn(a, b, c, d, e, f, g, h, i, j, k, l); }
+  else if constexpr (count == 13) { auto &[a, b, c, d, e, f, g, h, i, j, k, l, m] = value; return fn(a, b, c, d, e, f, g, h, i, j, k, l, m); }
+  else if constexpr (count == 14) { auto &[a, b, c, d, e, f, g, h, i, j, k, l, m, n] = value; return fn(a, b, c, d, e, f, g, h, i, j, k, l, m, n); }
+  else if constexpr (count == 15) { auto &[a, b, c, d, e, f, g, h, i, j, k, l, m, n, o] = value; return fn(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o); }
+  else if constexpr (count == 16) { auto &[a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p] = value; return fn(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p); }
+}
+
+struct field_types_of {
+  template <class ...Fs> std::tuple<std::remove_cvref_t<Fs>...> operator()(Fs &...) const;
+};
+
+template <class T> using field_types = decltype(with_fields(std::declval<T &>(), field_types_of{}));
+
+template <class T, class = field_types<T>> struct aggregate_bounds;
+
+template <class T, class ...Fs>
+struct aggregate_bounds<T, std::tuple<Fs...>> {
+  static constexpr size_t min = (size_t{0} + ... + min_packed_size<Fs>);
+  static constexpr size_t max = ((max_packed_size<Fs> == unbounded) || ...) ? unbounded : (size_t{0} + ... + max_packed_size<Fs>);
+  static constexpr bool sized = (presizable<Fs> && ...);
+};
+
+// a record of raw fields is raw itself
+template <class T, class = field_types<T>> struct aggregate_raw {};
+
+template <class T, class ...Fs>
+requires (raw_encodable<Fs> && ...)
+struct aggregate_raw<T, std::tuple<Fs...>> {
+  static constexpr size_t size = (size_t{0} + ... + raw<Fs>::size);
+
+  static void put(std::byte *out, const T &value) {
+    with_fields(value, [&](const auto &...fields) { ((raw<Fs>::put(out, fields), out += raw<Fs>::size), ...); });
+  }
+
+  static bool get(const std::byte *in, T &value) {
+    bool ok = true;
+    with_fields(value, [&](auto &...fields) { ((ok &= raw<Fs>::get(in, fields), in += raw<Fs>::size), ...); });
+    return ok;
+  }
+};
+
+// fields back to back, same as a define_pack() that does do_pack() on each in order. if they are
+// all raw, the whole record is packed into one claim() and unpacked out of one span
+template <class T>
+struct aggregate_impl {
+  // each field's values in turn, nested aggregates being packed flat
+  static constexpr std::optional<size_t> values = []<class ...Fs>(std::type_identity<std::tuple<Fs...>>) {
+    return (static_values<Fs>() && ...) ? std::optional<size_t>((size_t{0} + ... + *static_values<Fs>())) : std::nullopt;
+  }(std::type_identity<field_types<T>>{});
+
+  static void pack(Packer &packer, const T &value) {
+    if constexpr (raw_encodable<T>) {
+      if (std::byte *out = packer.claim(raw<T>::size)) {
+        raw<T>::put(out, value);
+        packer.advance(raw<T>::size);
+        count_packed(packer, BufferView(out, raw<T>::size));
+        return;
+      }
+    }
+    with_fields(value, [&](const auto &...fields) { (pack_one(packer, fields), ...); });
+  }
+
+  template <class Policy>
+  static std::optional<T> unpack(BasicUnpacker<Policy> &unpacker) {
+    T value = construct(unpacker);
+    $expect(unpack_into(unpacker, value));
+    return value;
+  }
+
+  template <class Policy>
+  static T construct(BasicUnpacker<Policy> &unpacker) {
+    return [&]<class ...Fs>(std::type_identity<std::tuple<Fs...>>) {
+      return T{detail::construct<Fs>(unpacker)...};
+    }(std::type_identity<field_types<T>>{});
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, T &value) {
+    if constexpr (raw_encodable<T>) {
+      // falls through to field by field if something was packed narrower (ints not fixed_width etc.)
+      const std::optional<BufferView> bytes = unpacker.peek_span(raw<T>::size);
+      if (bytes && raw<T>::get(bytes->data(), value)) {
+        count_unpacked(*bytes);
+        return unpacker.read_span(raw<T>::size).has_value();
+      }
+    }
+    return with_fields(value, [&](auto &...fields) { return (unpack_one_into(unpacker, fields) && ...); });
+  }
+
+  static size_t packed_size(const T &value) {
+    if constexpr (raw_encodable<T>) return raw<T>::size;
+    else return with_fields(value, [](const auto &...fields) { return msgpack::packed_size(fields...); });
+  }
+};
+
+}
+
+// records rewritten in place
+namespace msgpack {
+
+namespace detail {
+
+// the class and the type of the member a member pointer points to
+template <class M> struct member_pointer;
+
+template <class C, class F>
+struct member_pointer<F C::*> {
+  using owner = C;
+  using type = F;
+};
+
+}
+
+// where each field of a define_aggregate() T starts in it packed, for a T whose fields all have an
+// encoding of a fixed size (float, double, bool, fixed_width ints, std::array and aggregates of
+// those). such a record always packs the same way, so its fields are always in the same place
+template <class T>
+requires std::is_base_of_v<detail::aggregate_raw<T>, detail::raw<T>>
+struct layout {
+  static constexpr size_t size = detail::raw<T>::size;
+
+  // offsets[i] is where field i starts
+  static constexpr auto offsets = []<class ...Fs>(std::type_identity<std::tuple<Fs...>>) {
+    std::array<size_t, sizeof...(Fs)> offsets{};
+    size_t off = 0, i = 0;
+    ((offsets[i++] = off, off += detail::raw<Fs>::size), ...);
+    return offsets;
+  }(std::type_identity<detail::field_types<T>>{});
+
+  // which field field is, by comparing its address in a T with those of the fields in turn. the
+  // number of fields if it is none of them (a member of a base, say)
+  template <auto field>
+  requires std::is_same_v<typename detail::member_pointer<decltype(field)>::owner, T>
+  static constexpr size_t index = [] {
+    T probe{};
+    size_t i = 0, found = offsets.size();
+    detail::with_fields(probe, [&](auto &...fields) {
+      ((static_cast<const void *>(&fields) == static_cast<const void *>(&(probe.*field)) ? void(found = i) : void(), i++), ...);
+    });
+    return found;
+  }();
+
+  // where field starts, e.g. layout<T>::offset<&T::x>
+  template <auto field>
+  static constexpr size_t offset = [] {
+    static_assert(index<field> < offsets.size(), "field is not one of the fields T is packed as");
+    return offsets[index<field>];
+  }();
+};
+
+// overwrites field of the T packed at the start of record with value, without touching the rest,
+// e.g. patch<&T::x>(record, x) (see layout). false if record is too short, or the field there isn't
+// in the format it should be, as in a record that was packed some other way
+template <auto field, class T = typename detail::member_pointer<decltype(field)>::owner,
+          class F = typename detail::member_pointer<decltype(field)>::type>
+bool patch(const std::span<std::byte> record, const std::type_identity_t<F> &value) {
+  constexpr size_t off = layout<T>::template offset<field>;
+  if (record.size() < layout<T>::size) return false;
+  F old{};
+  if (!detail::raw<F>::get(record.data() + off, old)) return false;
+  detail::raw<F>::put(record.data() + off, value);
+  return true;
+}
+
+}
+
+// ext
+namespace msgpack {
+
+// specialize for T, then define_ext(T), to pack T as an ext:
+//   static constexpr int8_t type;                          0 and up, negative types are the spec's
+//   static size_t size(const T &value);                    payload size
+//   static void put(std::byte *out, const T &value);       writes the size(value) bytes of payload
+//   static bool get(const BufferView &payload, T &value);  false if the payload is malformed
+template <class T> struct ext;
+
+namespace detail {
+
+// format byte, then the length unless it's a fixext, then the type
+constexpr size_t ext_header_size(const size_t size) {
+  constexpr uint64_t one = 1;
+  if (size <= 16 && std::has_single_bit(size)) return 2;
+  return size < (one << 8) ? 3 : size < (one << 16) ? 4 : 6;
+}
+
+inline void put_ext_header(std::byte *out, const size_t size, const int8_t type) {
+  constexpr uint64_t one = 1;
+  switch (size) {
+    case 1:  *out++ = format::fixext_1;  break;
+    case 2:  *out++ = format::fixext_2;  break;
+    case 4:  *out++ = format::fixext_4;  break;
+    case 8:  *out++ = format::fixext_8;  break;
+    case 16: *out++ = format::fixext_16; break;
+    default:
+      if (size < (one << 8)) {
+        *out++ = format::ext_8;
+        *out++ = static_cast<std::byte>(size);
+      } else if (size < (one << 16)) {
+        *out++ = format::ext_16;
+        store_big_endian<uint16_t>(out, size);
+        out += 2;
+      } else {
+        *out++ = format::ext_32;
+        store_big_endian<uint32_t>(out, size);
+        out += 4;
+      }
+  }
+  *out = static_cast<std::byte>(type);
+}
+
+// payload of an ext that has to be of the given type. the length of a fixext comes out of the lead
+// table, after which the type byte and payload are one read
+template <class Policy>
+std::optional<BufferView> unpack_ext(BasicUnpacker<Policy> &unpacker, const int8_t type) {
+  const size_t at = unpacker.offset();
+  const Lead lead = $unwrap(unpack_lead(unpacker, Type::ext));
+  const uint64_t size = $unwrap(unpack_length(unpacker, lead));
+  const BufferView bytes = $unwrap(unpacker.read_span(1 + size));
+  if (static_cast<int8_t>(bytes[0]) != type) return unpacker.fail(Errc::type_mismatch, at);
+  return bytes.subspan(1);
+}
+
+// header and payload go into one claim(), or through a temporary if the sink can't fit them
+template <class T>
+struct ext_impl {
+  static void pack(Packer &packer, const T &value) {
+    const size_t size = ext<T>::size(value);
+    const size_t header = ext_header_size(size);
+    Buffer spill;
+    std::byte *out = packer.claim(header + size);
+    if (!out) {
+      spill.resize(header + size);
+      out = spill.data();
+    }
+    put_ext_header(out, size, ext<T>::type);
+    ext<T>::put(out + header, value);
+    if (spill.empty()) packer.advance(header + size);
+    else packer.write(spill);
+    count_packed(packer, out[0]);
+  }
+
+  template <class Policy>
+  static std::optional<T> unpack(BasicUnpacker<Policy> &unpacker) {
+    T value{};
+    $expect(unpack_into(unpacker, value));
+    return value;
+  }
+
+  template <class Policy>
+  static bool unpack_into(BasicUnpacker<Policy> &unpacker, T &value) {
+    const size_t at = unpacker.offset();
+    const std::optional<BufferView> payload = unpack_ext(unpacker, ext<T>::type);
+    if (!payload) return false;
+    if (!ext<T>::get(*payload, value)) {
+      unpacker.fail(Errc::invalid, at);
+      return false;
+    }
+    return true;
+  }
+
+  static size_t packed_size(const T &value) {
+    const size_t size = ext<T>::size(value);
+    return ext_header_size(size) + size;
+  }
+};
+
+// the spec's timestamp (ext -1): seconds and nanoseconds since the epoch, in the smallest of the
+// 32-bit (unsigned seconds only), 64-bit (30 bits of nanoseconds, 34 of unsigned seconds) and
+// 96-bit (32 bits of nanoseconds, 64 of signed seconds) forms that holds them
+template <class Duration>
+requires std::integral<typename Duration::rep>
+struct timestamp_ext {
+  static constexpr int8_t type = -1;
+
+  struct split {
+    int64_t seconds;
+    uint32_t nanoseconds;
+  };
+
+  static constexpr split of(const Duration &value) {
+    const auto seconds = std::chrono::floor<std::chrono::seconds>(value);
+    return {seconds.count(), static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(value - seconds).count())};
+  }
+
+  static constexpr size_t size(const Duration &value) {
+    const auto [seconds, nanoseconds] = of(value);
+    if (seconds >> 34 != 0) return 12;
+    return nanoseconds == 0 && seconds >> 32 == 0 ? 4 : 8;
+  }
+
+  static void put(std::byte *out, const Duration &value) {
+    const auto [seconds, nanoseconds] = of(value);
+    switch (size(value)) {
+      case 4:  store_big_endian<uint32_t>(out, seconds); break;
+      case 8:  store_big_endian<uint64_t>(out, uint64_t{nanoseconds} << 34 | seconds); break;
+      default:
+        store_big_endian<uint32_t>(out, nanoseconds);
+        store_big_endian<uint64_t>(out + 4, seconds);
+    }
+  }
+
+  // false for a length other than 4, 8 and 12, nanoseconds past 999999999, or a time Duration
+  // can't hold exactly
+  static bool get(const BufferView &payload, Duration &value) {
+    int64_t seconds;
+    uint32_t nanoseconds = 0;
+    switch (payload.size()) {
+      case 4: seconds = load_big_endian<uint32_t>(payload.data()); break;
+      case 8: {
+        const uint64_t bits = load_big_endian<uint64_t>(payload.data());
+        seconds = bits & ((uint64_t{1} << 34) - 1);
+        nanoseconds = bits >> 34;
+        break;
+      }
+      case 12:
+        nanoseconds = load_big_endian<uint32_t>(payload.data());
+        seconds = load_big_endian<uint64_t>(payload.data() + 4);
+        break;
+      default: return false;
+    }
+    if (nanoseconds > 999'999'999) return false;
+    const std::optional<int64_t> whole = ticks<std::ratio<1>>(seconds);
+    const std::optional<int64_t> fraction = ticks<std::nano>(nanoseconds);
+    int64_t total;
+    if (!whole || !fraction || __builtin_add_overflow(*whole, *fraction, &total)) return false;
+    if (std::cmp_less(total, std::numeric_limits<typename Duration::rep>::min()) ||
+        std::cmp_greater(total, std::numeric_limits<typename Duration::rep>::max())) return false;
+    value = Duration(static_cast<typename Duration::rep>(total));
+    return true;
+  }
+
+private:
+  // count units of Unit as ticks of Duration, worked out in the ratio between the two so that
+  // nothing overflows along the way (as Duration::max() in seconds would for hours). nullopt if
+  // that isn't a whole number of ticks, or more than an int64_t holds
+  template <class Unit>
+  static constexpr std::optional<int64_t> ticks(const int64_t count) {
+    using Ticks = std::ratio_divide<Unit, typename Duration::period>;
+    if (count % Ticks::den != 0) return std::nullopt;
+    int64_t result;
+    if (__builtin_mul_overflow(count / Ticks::den, Ticks::num, &result)) return std::nullopt;
+    return result;
+  }
+};
+
+}
+
+// durations are packed as a timestamp that far from the epoch
+template <class Rep, class Period>
+struct ext<std::chrono::duration<Rep, Period>> : detail::timestamp_ext<std::chrono::duration<Rep, Period>> {};
+
+template <class Duration>
+struct ext<std::chrono::time_point<std::chrono::system_clock, Duration>> {
+  using Time = std::chrono::time_point<std::chrono::system_clock, Duration>;
+  using Timestamp = detail::timestamp_ext<Duration>;
+
+  static constexpr int8_t type = Timestamp::type;
+  static constexpr size_t size(const Time &value) { return Timestamp::size(value.time_since_epoch()); }
+  static void put(std::byte *out, const Time &value) { Timestamp::put(out, value.time_since_epoch()); }
+
+  static bool get(const BufferView &payload, Time &value) {
+    Duration since_epoch;
+    if (!Timestamp::get(payload, since_epoch)) return false;
+    value = Time(since_epoch);
+    return true;
+  }
+};
+
+template <class Rep, class Period>
+struct impl<std::chrono::duration<Rep, Period>> : detail::ext_impl<std::chrono::duration<Rep, Period>> {};
+template <class Rep, class Period>
+inline constexpr size_t min_packed_size<std::chrono::duration<Rep, Period>> = 6;
+template <class Rep, class Period>
+inline constexpr size_t max_packed_size<std::chrono::duration<Rep, Period>> = 15;
+template <class Rep, class Period>
+inline constexpr bool has_packed_size<std::chrono::duration<Rep, Period>> = true;
+
+template <class Duration>
+struct impl<std::chrono::time_point<std::chrono::system_clock, Duration>> : detail::ext_impl<std::chrono::time_point<std::chrono::system_clock, Duration>> {};
+template <class Duration>
+inline constexpr size_t min_packed_size<std::chrono::time_point<std::chrono::system_clock, Duration>> = 6;
+template <class Duration>
+inline constexpr size_t max_packed_size<std::chrono::time_point<std::chrono::system_clock, Duration>> = 15;
+template <class Duration>
+inline constexpr bool has_packed_size<std::chrono::time_point<std::chrono::system_clock, Duration>> = true;
+
+}
+
+// navigating packed values without unpacking them
+namespace msgpack {
+
+namespace detail {
+
+struct Header {
+  Type type;
+  uint8_t size;       // bytes taken by the header, format byte included
+  uint64_t payload;   // bytes right after the header that belong to the value itself
+  uint64_t children;  // values nested right after that (2 per map entry)
+};
+
+// header at the start of bytes, nullopt if it's incomplete or not a valid format byte
+inline std::optional<Header> parse_header(const BufferView bytes) {
+  if (bytes.empty()) return std::nullopt;
+  const Lead lead = detail::lead(bytes[0]);
+  if (!lead.valid) return std::nullopt;
+
+  switch (lead.type) {
+    case Type::nil: case Type::bool_:  return Header{lead.type, 1, 0, 0};
+    case Type::int_: case Type::float_: return Header{lead.type, 1, lead.width, 0};
+    default: break;
+  }
+
+  // ext has its type byte between the length and the payload
+  const uint8_t size = 1 + lead.width + (lead.type == Type::ext);
+  if (bytes.size() < size) return std::nullopt;
+  const uint64_t length = lead.width ? load_big_endian(&bytes[1], lead.width) : static_cast<uint8_t>(lead.value);
+  switch (lead.type) {
+    case Type::array: return Header{lead.type, size, 0, length};
+    case Type::map:   return Header{lead.type, size, 0, 2 * length};
+    default:          return Header{lead.type, size, length, 0};
+  }
+}
+
+// the walk skip() does, left where it stopped so that it can be picked up again once more bytes
+// are in: off is where the first value not yet gone over starts, and count how many values are
+// still to go. false if bytes run out first (*missing set to at least how many more it takes) or
+// a format byte is invalid (*missing untouched)
+inline bool skip_on(const BufferView bytes, size_t &off, uint64_t &count, size_t *missing = nullptr) {
+  const auto truncated = [&](const size_t wanted) {
+    if (missing) *missing = wanted;
+    return false;
+  };
+  const size_t start = off;
+  const auto done = [&](const bool ok) {
+    count_skipped(off - start);
+    return ok;
+  };
+  while (count > 0) {
+    if (off > bytes.size()) return done(false);
+    if (off == bytes.size()) return done(truncated(1));
+    const Lead lead = detail::lead(bytes[off]);
+    if (!lead.valid) return done(false);
+    const size_t left = bytes.size() - off;
+    const std::optional<Header> header = parse_header(bytes.subspan(off));
+    if (!header) return done(truncated(1 + lead.width + (lead.type == Type::ext) - left));
+    if (header->payload > left - header->size) return done(truncated(header->size + header->payload - left));
+    off += header->size + header->payload;
+    count = count - 1 + header->children;
+  }
+  return done(true);
+}
+
+// offset right after the `count` values starting at `off`, looking at nothing but headers.
+// nullopt if they run past the end or aren't valid. if they run past the end, *missing is set to a
+// lower bound on how many more bytes they take
+inline std::optional<size_t> skip(const BufferView bytes, size_t off, uint64_t count = 1, size_t *missing = nullptr) {
+  $expect(skip_on(bytes, off, count, missing));
+  return off;
+}
+
+// a T that packed_values() can count
+template <class T>
+concept countable = static_values<T>().has_value() || std::is_default_constructible_v<T>;
+
+// how many values a T packs to: where the type doesn't say (see static_values()), what a
+// default-constructed one packs to, which a define_pack() of a fixed list of fields always does.
+// nullopt if there is no default-constructed T to go by
+template <class T>
+std::optional<size_t> packed_values() {
+  if constexpr (static_values<T>().has_value()) return static_values<T>();
+  else if constexpr (!std::is_default_constructible_v<T>) return std::nullopt;
+  else {
+    static const size_t count = [] {
+      const Buffer packed = pack(T{});
+      size_t count = 0;
+      for (size_t off = 0; off < packed.size(); count++) off = *skip(packed, off);
+      return count;
+    }();
+    return count;
+  }
+}
+
+}
+
+// one linear pass over the structure of a buffer of values packed back to back: every format byte
+// is valid and every length stays inside the buffer. one that passes can go to unpack_trusted()
+inline Error validate(const BufferView &buffer) {
+  uint64_t owed = 0;  // values still owed to the arrays and maps opened so far
+  size_t off = 0;
+  while (off < buffer.size()) {
+    if (!detail::lead(buffer[off]).valid) return {Errc::invalid, off};
+    const std::optional<detail::Header> header = detail::parse_header(buffer.subspan(off));
+    if (!header || header->payload > buffer.size() - off - header->size) return {Errc::truncated, off};
+    off += header->size + header->payload;
+    owed = owed - (owed > 0) + header->children;
+  }
+  if (owed > 0) return {Errc::truncated, off};
+  return {};
+}
+
+class View;
+
+// walks the values of a buffer one by one
+class Cursor {
+public:
+  explicit Cursor(const BufferView &buffer, const size_t off = 0) : buffer(buffer), off(off) {}
+
+  std::optional<Type> peek_type() const {
+    const detail::Header header = $unwrap(detail::parse_header(buffer.subspan(off)));
+    return header.type;
+  }
+
+  // steps over the next value, nested ones included. false if it's malformed
+  bool skip() {
+    const std::optional<size_t> next = detail::skip(buffer, off);
+    if (next) off = *next;
+    return next.has_value();
+  }
+
+  // bytes of the next value, without moving
+  std::optional<BufferView> peek_bytes() const {
+    const size_t next = $unwrap(detail::skip(buffer, off));
+    return buffer.subspan(off, next - off);
+  }
+
+  template <class T>
+  std::optional<T> read(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+    Unpacker unpacker(buffer.subspan(off), resource);
+    std::optional<T> value = unpack_one<T>(unpacker);
+    if (value) off = buffer.size() - unpacker.size();
+    return value;
+  }
+
+  // the elements of the array (or the keys and values of the map) at the cursor, which moves past it
+  std::optional<View> enter();
+
+  size_t offset() const { return off; }
+  bool at_end() const { return off >= buffer.size(); }
+
+private:
+  BufferView buffer;
+  size_t off;
+};
+
+// non-owning view over a sequence of packed values. the first call that needs to know where the
+// values are walks the buffer once and indexes them, after which any value is O(1) away
+class View {
+public:
+  explicit View(const BufferView &buffer) : buffer(buffer) {}
+
+  Cursor cursor() const { return Cursor(buffer); }
+
+  // number of values, nullopt if the buffer is malformed
+  std::optional<size_t> size() {
+    $expect(index());
+    return offsets.size() - 1;
+  }
+
+  std::optional<BufferView> at(const size_t k) {
+    $expect(index() && k + 1 < offsets.size());
+    return buffer.subspan(offsets[k], offsets[k + 1] - offsets[k]);
+  }
+
+  std::optional<Type> type(const size_t k) {
+    const BufferView bytes = $unwrap(at(k));
+    return Cursor(bytes).peek_type();
+  }
+
+  template <class T>
+  std::optional<T> get(const size_t k) {
+    const BufferView bytes = $unwrap(at(k));
+    return unpack<T>(bytes);
+  }
+
+  BufferView bytes() const { return buffer; }
+
+private:
+  bool index() {
+    if (!offsets.empty()) return valid;
+    for (size_t off = 0; off < buffer.size(); ) {
+      offsets.push_back(off);
+      const std::optional<size_t> next = detail::skip(buffer, off);
+      if (!next) { valid = false; return valid; }
+      off = *next;
+    }
+    offsets.push_back(buffer.size());
+    valid = true;
+    return valid;
+  }
+
+  BufferView buffer;
+  std::vector<size_t> offsets;
+  bool valid = false;
+};
+
+inline std::optional<View> Cursor::enter() {
+  const detail::Header header = $unwrap(detail::parse_header(buffer.subspan(off)));
+  $expect(header.type == Type::array || header.type == Type::map);
+  const size_t begin = off + header.size;
+  const size_t end = $unwrap(detail::skip(buffer, begin, header.children));
+  off = end;
+  return View(buffer.subspan(begin, end - begin));
+}
+
+}
+
+// messages arriving in chunks
+namespace msgpack {
+
+// decodes a stream of messages, each being Ts... packed back to back, from chunks of bytes as they
+// arrive. a message is only decoded once skipping over its headers gets through as many values as
+// it packs to (see detail::packed_values()), that is once all of it is in, so nothing is decoded
+// twice. the skip picks up where it left off on the next feed(), so no byte is looked at twice
+// either, however many pieces a message comes in
+//
+// fed chunks are borrowed until next() runs out of data, at which point the unread tail (the start
+// of a message, never part of one that has been decoded) is copied. views (std::string_view etc.)
+// in a message point into the chunk it came in, or into that copy if it came in pieces, and so are
+// valid until the next feed(), and then only as long as the chunk is
+template <class ...Ts>
+requires (sizeof...(Ts) > 0 && (detail::countable<Ts> && ...))
+class StreamUnpacker {
+public:
+  enum class Status { ok, incomplete, invalid };
+  using Message = std::conditional_t<sizeof...(Ts) == 1, std::tuple_element_t<0, std::tuple<Ts...>>, std::tuple<Ts...>>;
+
+  StreamUnpacker() = default;
+  // interned strings in Ts are looked up in interner. the ones it stores stay valid across feed()s,
+  // but those it has no room for (id none) view the chunk like any other view
+  explicit StreamUnpacker(Interner &interner) : interner(&interner) {}
+
+  void feed(const BufferView &chunk) {
+    if (window.empty()) {
+      window = chunk;
+      borrowed = true;
+      return;
+    }
+    if (borrowed) pending.assign(window.begin(), window.end());
+    else          pending.erase(pending.begin(), pending.end() - window.size());
+    pending.insert(pending.end(), chunk.begin(), chunk.end());
+    window = pending;
+    borrowed = false;
+  }
+
+  // decodes the next message. on ok it is available through get() until the next call
+  Status next() {
+    if (status == Status::invalid) return status;
+    message.reset();
+    if (window.size() < wanted) return incomplete();
+
+    size_t missing = 0;
+    if (!detail::skip_on(window, skipped, owed, &missing)) {
+      if (!missing) return status = Status::invalid;
+      wanted = window.size() + missing;
+      return incomplete();
+    }
+
+    // all of it is in, so failing to decode it, or it being shorter than it skipped as, is invalid
+    Unpacker unpacker(window.first(skipped), std::pmr::get_default_resource(), interner);
+    std::tuple<std::optional<Ts>...> parts;
+    const bool ok = [&]<size_t ...Is>(std::index_sequence<Is...>) {
+      return ((std::get<Is>(parts) = unpack_one<Ts>(unpacker)).has_value() && ...);
+    }(std::index_sequence_for<Ts...>{});
+    if (!ok || !unpacker.at_end()) return status = Status::invalid;
+
+    message = std::apply([](auto &...parts) { return Message{std::move(*parts)...}; }, parts);
+    window = window.subspan(skipped);
+    consumed_ += skipped;
+    skipped = 0;
+    owed = values();
+    wanted = 0;
+    return status = Status::ok;
+  }
+
+  Message &get() { return *message; }
+
+  // when incomplete, at least this many more bytes are needed. 0 otherwise
+  size_t needed() const { return status == Status::incomplete && wanted > window.size() ? wanted - window.size() : 0; }
+  // offset into the stream where the last complete message ended
+  size_t consumed() const { return consumed_; }
+
+private:
+  Status incomplete() {
+    if (borrowed) {
+      pending.assign(window.begin(), window.end());
+      window = pending;
+      borrowed = false;
+    }
+    return status = Status::incomplete;
+  }
+
+  static size_t values() { return (size_t{0} + ... + *detail::packed_values<Ts>()); }
+
+  Interner *interner = nullptr;
+  Buffer pending;
+  BufferView window;
+  bool borrowed = false;
+  // how far into window the skip over the message has got, and how many values it still has to go
+  size_t skipped = 0;
+  uint64_t owed = values();
+  size_t wanted = 0;
+  size_t consumed_ = 0;
+  std::optional<Message> message;
+  Status status = Status::ok;
+};
+
+}
+
+// constant messages, packed at compile time
+namespace msgpack {
+
+// a string literal as a template argument, packs as a str
+template <size_t N>
+struct fixed_string {
+  char data[N];
+
+  constexpr fixed_string(const char (&s)[N]) { std::copy_n(s, N, data); }
+  constexpr std::string_view view() const { return {data, N - 1}; }
+};
+
+template <size_t N>
+struct impl<fixed_string<N>> {
+  static constexpr void pack(Packer &packer, const fixed_string<N> &value) { pack_one(packer, value.view()); }
+  static constexpr size_t packed_size(const fixed_string<N> &value) { return impl<std::string_view>::packed_size(value.view()); }
+};
+
+template <size_t N>
+inline constexpr bool has_packed_size<fixed_string<N>> = true;
+
+// just the header of an array or map of `size` elements, whose elements are then packed one by one.
+// this is how a message whose tail is only known at run time gets a constant prefix
+struct array_header {
+  size_t size;
+  bool operator==(const array_header &) const = default;
+};
+
+struct map_header {
+  size_t size;
+  bool operator==(const map_header &) const = default;
+};
+
+define_constexpr_pack(array_header) { detail::pack_array_header(packer, value.size); }
+define_unpack(array_header) { return array_header{$unwrap(detail::unpack_array_header(unpacker))}; }
+template<> constexpr size_t impl<array_header>::packed_size(const array_header &value) { return detail::container_header_size(value.size); }
+template<> inline constexpr bool has_packed_size<array_header> = true;
+
+define_constexpr_pack(map_header) { detail::pack_map_header(packer, value.size); }
+define_unpack(map_header) { return map_header{$unwrap(detail::unpack_map_header(unpacker))}; }
+template<> constexpr size_t impl<map_header>::packed_size(const map_header &value) { return detail::container_header_size(value.size); }
+template<> inline constexpr bool has_packed_size<map_header> = true;
+
+// values packed back to back at compile time, into an array of exactly the size they take. works
+// for types packed with define_constexpr_pack() (scalars, strings as fixed_string, pairs, headers):
+//   constexpr auto heartbeat = pack_static<array_header{2}, fixed_string("hb"), 0u>();
+template <auto ...values>
+consteval auto pack_static() {
+  std::array<std::byte, packed_size(values...)> bytes{};
+  SpanSink sink(bytes);
+  Packer packer(sink);
+  (pack_one(packer, values), ...);
+  packer.flush();
+  return bytes;
+}
+
+// a precomputed prefix (e.g. from pack_static()) followed by values packed at run time
+template <class ...Ts>
+Buffer pack_with_prefix(const BufferView &prefix, const Ts &...values) {
+  Packer packer;
+  if constexpr ((presizable<Ts> && ...)) packer.reserve(prefix.size() + packed_size(values...));
+  else packer.reserve(prefix.size());
+  packer.write(prefix);
+  (pack_one<Ts>(packer, values), ...);
+  return packer.take();
+}
+
+}
+
+// batches of records packed back to back, unpacked and packed on every core
+namespace msgpack {
+
+namespace detail {
+
+// calls f(begin, end) over [0, n) in chunks that the threads claim off a shared counter, so that
+// one getting through its chunks early just claims more
+template <class F>
+void parallel_for(const size_t n, const unsigned threads, F &&f) {
+  const size_t width = std::max(1u, threads);
+  const size_t chunk = std::max<size_t>(1, n / (8 * width));
+  std::atomic<size_t> next = 0;
+  const auto work = [&] {
+    for (size_t begin; (begin = next.fetch_add(chunk, std::memory_order_relaxed)) < n; ) f(begin, std::min(n, begin + chunk));
+  };
+  std::vector<std::jthread> pool;
+  for (size_t i = 1; i < std::min(width, (n + chunk - 1) / chunk); i++) pool.emplace_back(work);
+  work();
+}
+
+// how many values a T packs to, going by the type (see packed_values()), or else by the first one
+// in buffer
+template <class T>
+std::optional<size_t> values_per_record(const BufferView &buffer, Error &error) {
+  if (const std::optional<size_t> count = packed_values<T>()) return count;
+  Unpacker unpacker(buffer);
+  if (!unpack_one<T>(unpacker)) {
+    unpacker.fail(Errc::invalid);
+    error = unpacker.error();
+    return std::nullopt;
+  }
+  const size_t end = buffer.size() - unpacker.size();
+  Cursor cursor(buffer);
+  size_t count = 0;
+  while (cursor.offset() < end && cursor.skip()) count++;
+  $expect(cursor.offset() == end);
+  return count;
+}
+
+}
+
+// where each record in a buffer of them starts, plus where the last one ends, looking at nothing
+// but headers. nullopt if the buffer doesn't split evenly into records of values_per_record values
+inline std::optional<std::vector<size_t>> split(const BufferView &buffer, const size_t values_per_record = 1) {
+  std::vector<size_t> offsets{0};
+  for (size_t off = 0; off < buffer.size(); offsets.push_back(off)) off = $unwrap(detail::skip(buffer, off, values_per_record));
+  return offsets;
+}
+
+// unpacks Ts packed back to back: split() finds where each starts, then they are all unpacked in
+// parallel into a vector allocated up front. on failure, error is that of the first bad record.
+// the split goes by how many values a T packs to (see detail::packed_values())
+template <class T>
+requires (!std::is_same_v<T, bool>)
+std::optional<std::vector<T>> unpack_batch(const BufferView &buffer, Error &error, const unsigned threads = std::thread::hardware_concurrency()) {
+  error = {};
+  if (buffer.empty()) return std::vector<T>{};
+  const size_t values_per_record = $unwrap(detail::values_per_record<T>(buffer, error));
+  const std::optional<std::vector<size_t>> offsets = split(buffer, values_per_record);
+  if (!offsets) {
+    error = validate(buffer);
+    if (!error) error = {Errc::trailing_bytes, buffer.size()};
+    return std::nullopt;
+  }
+  const auto record = [&](const size_t i) { return buffer.subspan((*offsets)[i], (*offsets)[i + 1] - (*offsets)[i]); };
+
+  std::vector<T> values(offsets->size() - 1);
+  std::atomic<size_t> first_bad = values.size();
+  detail::parallel_for(values.size(), threads, [&](const size_t begin, const size_t end) {
+    for (size_t i = begin; i < end && i < first_bad.load(std::memory_order_relaxed); i++) {
+      if (unpack_into(record(i), values[i])) continue;
+      for (size_t bad = first_bad.load(); i < bad && !first_bad.compare_exchange_weak(bad, i); ) {}
+      return;
+    }
+  });
+
+  if (first_bad == values.size()) return values;
+  unpack_into(record(first_bad), values[first_bad], error);
+  error.offset += (*offsets)[first_bad];
+  return std::nullopt;
+}
+
+template <class T>
+std::optional<std::vector<T>> unpack_batch(const BufferView &buffer, const unsigned threads = std::thread::hardware_concurrency()) {
+  Error error;
+  return unpack_batch<T>(buffer, error, threads);
+}
+
+// packs values back to back. every value's packed size is worked out first (in parallel, unless
+// it's fixed), then each is packed in parallel straight into its place in the result. values whose
+// size could only be had by packing them are instead packed in parallel a chunk at a time, each
+// chunk into a buffer of its own, and the chunks copied together
+template <std::ranges::contiguous_range R>
+Buffer pack_batch(const R &values, const unsigned threads = std::thread::hardware_concurrency()) {
+  using T = std::ranges::range_value_t<R>;
+  const std::span<const T> span(values);
+  if constexpr (!presizable<T>) {
+    // sizing the slots by packing into a NullSink first would encode everything twice, which costs
+    // more than the one copy of each chunk
+    std::mutex mutex;
+    std::vector<std::pair<size_t, Buffer>> chunks;
+    detail::parallel_for(span.size(), threads, [&](const size_t begin, const size_t end) {
+      Packer packer;
+      for (size_t i = begin; i < end; i++) pack_one(packer, span[i]);
+      Buffer chunk = packer.take();
+      const std::lock_guard lock(mutex);
+      chunks.emplace_back(begin, std::move(chunk));
+    });
+    std::ranges::sort(chunks, {}, &std::pair<size_t, Buffer>::first);
+    Buffer buffer;
+    buffer.reserve(std::accumulate(chunks.begin(), chunks.end(), size_t{0}, [](const size_t size, const auto &chunk) { return size + chunk.second.size(); }));
+    for (const auto &[begin, chunk] : chunks) buffer.insert(buffer.end(), chunk.begin(), chunk.end());
+    return buffer;
+  } else {
+    std::vector<size_t> offsets(span.size() + 1);
+    if constexpr (fixed_size<T>) {
+      for (size_t i = 0; i < offsets.size(); i++) offsets[i] = i * max_packed_size<T>;
+    } else {
+      detail::parallel_for(span.size(), threads, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; i++) offsets[i + 1] = impl<T>::packed_size(span[i]);
+      });
+      std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    }
+
+    Buffer buffer(offsets.back());
+    detail::parallel_for(span.size(), threads, [&](const size_t begin, const size_t end) {
+      const std::span<std::byte> slot = std::span(buffer).subspan(offsets[begin], offsets[end] - offsets[begin]);
+      SpanSink sink(slot);
+      Packer packer(sink);
+      for (size_t i = begin; i < end; i++) pack_one(packer, span[i]);
+    });
+    return buffer;
+  }
+}
 
-  return detail::unpack_bytes<std::vector<uint8_t>, format::bin_8, format::bin_16, format::bin_32>(unpacker, read);
 }
 
 #undef $unwrap
-#undef $expect_in_range
 #undef $expect_in_urange
 #undef $expect_byte
 #undef $expect_read
+#undef $expect_peek
+#undef $expect_or
 #undef $expect
 #undef $fail
 
 #define do_pack(value) pack_one(packer, value)
 #define do_unpack(T) ({ auto&& opt = unpack_one<T>(unpacker); if (!opt) return std::nullopt; *opt; })
+#define do_unpack_into(field) if (!unpack_one_into(unpacker, field)) return false
 
 // global scope pollution:
 // - define_pack()
+// - define_constexpr_pack()
 // - define_unpack()
+// - define_unpack_into()
+// - define_packed_size()
+// - define_packed_size_bounds()
+// - define_aggregate()
+// - define_ext()
 // - do_pack()
 // - do_unpack()
+// - do_unpack_into()
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <semaphore>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "mpack.h"
+
+// coroutine front end over file descriptors: values are decoded out of one chunk while the next is
+// being read, and packed into one batch while the last is being written (posix only)
+namespace msgpack {
+
+// yields values lazily, one per resumption (std::generator, before c++23). async in that the
+// readers below keep the next chunk of input coming in on a helper thread in the meantime
+template <class T>
+class async_generator {
+public:
+  struct promise_type {
+    T *value = nullptr;
+    std::exception_ptr exception;
+
+    async_generator get_return_object() { return async_generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    // a yielded temporary lives until the coroutine resumes, so pointing at it is enough
+    std::suspend_always yield_value(T &value) noexcept { this->value = std::addressof(value); return {}; }
+    std::suspend_always yield_value(T &&value) noexcept { this->value = std::addressof(value); return {}; }
+    void return_void() {}
+    void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  struct sentinel {};
+
+  class iterator {
+  public:
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    T &operator*() const { return *handle.promise().value; }
+    iterator &operator++() { handle.resume(); rethrow(); return *this; }
+    void operator++(int) { ++*this; }
+    bool operator==(sentinel) const { return handle.done(); }
+
+  private:
+    friend class async_generator;
+    explicit iterator(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    void rethrow() const {
+      if (handle.done() && handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+    }
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  async_generator(async_generator &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+  async_generator &operator=(async_generator other) noexcept { std::swap(handle, other.handle); return *this; }
+  ~async_generator() { if (handle) handle.destroy(); }
+
+  // only once: there is no going back
+  iterator begin() {
+    iterator it(handle);
+    ++it;
+    return it;
+  }
+
+  sentinel end() const { return {}; }
+
+private:
+  explicit async_generator(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+// reads an fd chunk by chunk into two buffers on a helper thread: while one chunk is handed out,
+// the next one is read into the other
+class ChunkReader {
+public:
+  explicit ChunkReader(const int fd, const size_t chunk_size = 1 << 16) : fd(fd), buffers{Buffer(chunk_size), Buffer(chunk_size)} {
+    if (::pipe2(wake, O_CLOEXEC) != 0) wake[0] = wake[1] = -1;
+    thread = std::jthread([this] { run(); });
+  }
+
+  ChunkReader(const ChunkReader &) = delete;
+  ChunkReader &operator=(const ChunkReader &) = delete;
+
+  ~ChunkReader() {
+    stopping = true;
+    if (wake[1] >= 0) (void)!::write(wake[1], "", 1);
+    free.release();
+    thread.join();
+    for (const int end : wake) if (end >= 0) ::close(end);
+  }
+
+  // the next chunk, valid until the next call. empty at the end of input, or if read() failed
+  BufferView next() {
+    if (ended) return {};
+    if (held) free.release();
+    ready.acquire();
+    held = true;
+    const size_t i = taken++ % 2;
+    ended = sizes[i] == 0;
+    return BufferView(buffers[i]).first(sizes[i]);
+  }
+
+  // errno of the read() that failed, 0 if none did
+  int error() const { return error_; }
+
+private:
+  void run() {
+    for (size_t i = 0; ; i = (i + 1) % 2) {
+      free.acquire();
+      if (stopping) return;
+      const ssize_t n = read(buffers[i]);
+      sizes[i] = std::max<ssize_t>(n, 0);
+      ready.release();
+      if (n <= 0) return;
+    }
+  }
+
+  // one read(), after waiting until there is input or the reader is going away
+  ssize_t read(Buffer &buffer) {
+    while (true) {
+      pollfd fds[2] = {{fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+      if (::poll(fds, wake[0] >= 0 ? 2 : 1, -1) < 0) {
+        if (errno == EINTR) continue;
+        error_ = errno;
+        return -1;
+      }
+      if (fds[1].revents) return 0;
+      const ssize_t n = ::read(fd, buffer.data(), buffer.size());
+      if (n >= 0) return n;
+      if (errno != EINTR && errno != EAGAIN) {
+        error_ = errno;
+        return -1;
+      }
+    }
+  }
+
+  int fd;
+  int wake[2];
+  Buffer buffers[2];
+  size_t sizes[2] = {};
+  std::counting_semaphore<> free{2};
+  std::counting_semaphore<> ready{0};
+  size_t taken = 0;
+  bool held = false;
+  bool ended = false;
+  std::atomic<bool> stopping = false;
+  std::atomic<int> error_ = 0;
+  std::jthread thread;
+};
+
+// sink that fills one buffer while the other is being written to fd on a helper thread, so that
+// packing goes on during the write(). each buffer goes out in as few write()s as fd takes
+class ChunkWriter : public Sink {
+public:
+  explicit ChunkWriter(const int fd, const size_t chunk_size = 1 << 16) : fd(fd), buffers{Buffer(chunk_size), Buffer(chunk_size)} {
+    thread = std::jthread([this] { run(); });
+  }
+
+  ChunkWriter(const ChunkWriter &) = delete;
+  ChunkWriter &operator=(const ChunkWriter &) = delete;
+
+  ~ChunkWriter() override {
+    flush();
+    stopping = true;
+    ready.release();
+    thread.join();
+  }
+
+  std::span<std::byte> acquire(size_t hint) override {
+    Buffer *buffer = &buffers[current];
+    if (buffer->size() - used < std::max<size_t>(hint, 1)) {
+      submit();
+      buffer = &buffers[current];
+      if (buffer->size() < hint) buffer->resize(hint);
+    }
+    return std::span(*buffer).subspan(used);
+  }
+
+  void release(size_t used) override {
+    this->used += used;
+    total += used;
+  }
+
+  // hands over what is buffered and waits for all of it to be written. false if a write() failed
+  bool flush() {
+    if (used) submit();
+    // the other buffer being free means nothing is in flight
+    free.acquire();
+    free.release();
+    return error_ == 0;
+  }
+
+  // bytes accepted so far
+  size_t size() const { return total; }
+  // errno of the write() that failed, 0 if none did
+  int error() const { return error_; }
+
+private:
+  // queues the current buffer and switches to the other one once it has been written
+  void submit() {
+    sizes[current] = used;
+    ready.release();
+    current = (current + 1) % 2;
+    used = 0;
+    free.acquire();
+  }
+
+  void run() {
+    for (size_t i = 0; ; i = (i + 1) % 2) {
+      ready.acquire();
+      if (stopping) return;
+      for (size_t off = 0; off < sizes[i] && !error_; ) {
+        const ssize_t n = ::write(fd, buffers[i].data() + off, sizes[i] - off);
+        if (n > 0) off += n;
+        else if (n == 0) error_ = EIO;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) wait_writable();
+        else if (errno != EINTR) error_ = errno;
+      }
+      free.release();
+    }
+  }
+
+  // for a non-blocking fd that is full, rather than trying write() again straight away
+  void wait_writable() {
+    pollfd out = {fd, POLLOUT, 0};
+    while (::poll(&out, 1, -1) < 0) {
+      if (errno != EINTR) {
+        error_ = errno;
+        return;
+      }
+    }
+  }
+
+  int fd;
+  Buffer buffers[2];
+  size_t sizes[2] = {};
+  size_t current = 0;
+  size_t used = 0;
+  size_t total = 0;
+  // the buffer being filled is never free, so one is to begin with
+  std::counting_semaphore<2> free{1};
+  std::counting_semaphore<2> ready{0};
+  std::atomic<bool> stopping = false;
+  std::atomic<int> error_ = 0;
+  std::jthread thread;
+};
+
+// Ts read off fd until it ends, decoded out of each chunk as soon as it is in while the next one is
+// read. a value is only decoded once all of it is in (see StreamUnpacker), so a define_unpack that
+// returns early is never cut short. afterwards error is none if the input ended cleanly between
+// values, truncated if it ended partway through one, io at the offset decoded up to if a read()
+// failed, and invalid at the stream offset of a malformed value. error has to outlive the generator.
+// views in T are only valid until the next value
+template <class T>
+async_generator<T> unpack_stream(const int fd, Error &error, const size_t chunk_size = 1 << 16) {
+  error = {};
+  ChunkReader reader(fd, chunk_size);
+  StreamUnpacker<T> stream;
+  size_t fed = 0;
+  while (true) {
+    const BufferView chunk = reader.next();
+    if (chunk.empty()) break;
+    stream.feed(chunk);
+    fed += chunk.size();
+    typename StreamUnpacker<T>::Status status;
+    while ((status = stream.next()) == StreamUnpacker<T>::Status::ok) co_yield std::move(stream.get());
+    if (status == StreamUnpacker<T>::Status::invalid) {
+      error = {Errc::invalid, stream.consumed()};
+      co_return;
+    }
+  }
+  if (reader.error()) error = {Errc::io, stream.consumed()};
+  else if (stream.consumed() != fed) error = {Errc::truncated, stream.consumed()};
+}
+
+// packs every value of a range (e.g. an async_generator) to fd, batched into chunk_size write()s
+// that go on while the next batch is packed. false if a write() failed
+template <std::ranges::input_range R>
+bool pack_stream(const int fd, R &&values, const size_t chunk_size = 1 << 16) {
+  ChunkWriter writer(fd, chunk_size);
+  {
+    Packer packer(writer);
+    for (auto &&value : values) pack_one<std::remove_cvref_t<decltype(value)>>(packer, value);
+  }
+  return writer.flush();
+}
+
+}
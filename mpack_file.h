@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cerrno>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mpack.h"
+
+// record files: values packed back to back in a file, read through a mapping of it (posix only)
+namespace msgpack {
+
+// read-only mapping of a whole file
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+      size = st.st_size;
+      if (size == 0) open = true;
+      else if (void *map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0); map != MAP_FAILED) {
+        data = static_cast<const std::byte *>(map);
+        open = true;
+      }
+    }
+    ::close(fd);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { if (data) ::munmap(const_cast<std::byte *>(data), size); }
+
+  bool is_open() const { return open; }
+  BufferView bytes() const { return {data, data ? size : 0}; }
+
+private:
+  const std::byte *data = nullptr;
+  size_t size = 0;
+  bool open = false;
+};
+
+// buffered file output: bytes pile up in a buffer of flush_size that goes out in one write() when
+// full, or on flush()
+class FileSink : public Sink {
+public:
+  explicit FileSink(int fd, size_t flush_size = 1 << 16) : fd(fd), flush_size(std::max<size_t>(flush_size, 1)) {}
+  FileSink(const FileSink &) = delete;
+  FileSink &operator=(const FileSink &) = delete;
+  ~FileSink() override { flush(); }
+
+  std::span<std::byte> acquire(size_t hint) override {
+    if (buffer.size() - used < std::max<size_t>(hint, 1) && !flush()) return {};
+    if (buffer.size() < std::max(flush_size, hint)) buffer.resize(std::max(flush_size, hint));
+    return std::span(buffer).subspan(used);
+  }
+
+  void release(size_t used) override {
+    this->used += used;
+    total += used;
+  }
+
+  // writes out whatever is buffered. false if a write() has failed, after which nothing is written
+  bool flush() {
+    for (size_t off = 0; off < used && !failed_; ) {
+      const ssize_t n = ::write(fd, buffer.data() + off, used - off);
+      if (n > 0) off += n;
+      else if (n == 0 || errno != EINTR) failed_ = true;
+    }
+    used = 0;
+    return !failed_;
+  }
+
+  // bytes accepted so far
+  size_t size() const { return total; }
+  bool failed() const { return failed_; }
+
+private:
+  int fd;
+  size_t flush_size;
+  Buffer buffer;
+  size_t used = 0;
+  size_t total = 0;
+  bool failed_ = false;
+};
+
+// packs straight into a shared mapping of the file, which grows by doubling as it fills up.
+// finish() cuts the file down to what was actually written
+class MappedFileSink : public Sink {
+public:
+  explicit MappedFileSink(int fd) : fd(fd) {}
+  MappedFileSink(const MappedFileSink &) = delete;
+  MappedFileSink &operator=(const MappedFileSink &) = delete;
+  ~MappedFileSink() override { finish(); }
+
+  std::span<std::byte> acquire(size_t hint) override {
+    if (capacity - used < std::max<size_t>(hint, 1) && !grow(std::max({2 * capacity, used + hint, min_capacity}))) return {};
+    return {map + used, capacity - used};
+  }
+
+  void release(size_t used) override { this->used += used; }
+
+  // unmaps and truncates the file to size(). false if that, or growing the mapping earlier, failed
+  bool finish() {
+    if (map) ::munmap(map, capacity);
+    map = nullptr;
+    capacity = 0;
+    if (!finished && ::ftruncate(fd, used) != 0) failed_ = true;
+    finished = true;
+    return !failed_;
+  }
+
+  size_t size() const { return used; }
+  bool failed() const { return failed_; }
+
+private:
+  static constexpr size_t min_capacity = 1 << 20;
+
+  bool grow(size_t new_capacity) {
+    if (failed_ || finished) return false;
+    if (map) ::munmap(map, capacity);
+    map = nullptr;
+    capacity = 0;
+    void *grown = MAP_FAILED;
+    if (::ftruncate(fd, new_capacity) == 0) grown = ::mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (grown == MAP_FAILED) {
+      failed_ = true;
+      return false;
+    }
+    map = static_cast<std::byte *>(grown);
+    capacity = new_capacity;
+    return true;
+  }
+
+  int fd;
+  std::byte *map = nullptr;
+  size_t capacity = 0;
+  size_t used = 0;
+  bool finished = false;
+  bool failed_ = false;
+};
+
+// the sidecar index of a record file: where each record starts, plus where the last one ends, as
+// packed fixed_width<std::vector<uint64_t>>
+inline std::string index_path(const std::string &path) { return path + ".idx"; }
+
+// writes Ts to a new file (or over an existing one), optionally with a sidecar index. whatever
+// sidecar the file had is removed up front, so that none is left to go stale
+template <class T>
+class RecordWriter {
+public:
+  struct Options {
+    // pack into a growing mapping of the file rather than through buffered write()s
+    bool mapped = false;
+    size_t flush_size = 1 << 16;
+    bool index = false;
+  };
+
+  explicit RecordWriter(const std::string &path, const Options &options = {})
+    : path(path), options(options), fd(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+      file_sink(options.mapped ? nullptr : std::make_unique<FileSink>(fd, options.flush_size)),
+      mapped_sink(options.mapped ? std::make_unique<MappedFileSink>(fd) : nullptr),
+      packer(file_sink ? static_cast<Sink &>(*file_sink) : *mapped_sink) {
+    if (is_open()) ::unlink(index_path(path).c_str());
+  }
+
+  RecordWriter(const RecordWriter &) = delete;
+  RecordWriter &operator=(const RecordWriter &) = delete;
+  ~RecordWriter() { close(); }
+
+  bool is_open() const { return fd >= 0; }
+
+  // false once anything has failed to make it to the file
+  bool write(const T &record) {
+    if (!is_open()) return false;
+    if (options.index) offsets.push_back(packer.size());
+    pack_one(packer, record);
+    return !packer.overflowed();
+  }
+
+  // bytes written so far
+  size_t size() const { return packer.size(); }
+
+  bool close() {
+    if (!is_open()) return false;
+    packer.flush();
+    // the sink is finished either way, so that a mapped file is still cut down to what was written
+    bool ok = file_sink ? file_sink->flush() : mapped_sink->finish();
+    ok = ok && !packer.overflowed();
+    if (ok && options.index) {
+      offsets.push_back(packer.size());
+      const int index_fd = ::open(index_path(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      FileSink index_sink(index_fd);
+      ok = index_fd >= 0 && pack_into(index_sink, fixed_width<std::vector<uint64_t>>{std::move(offsets)}) && index_sink.flush();
+      if (index_fd >= 0) ::close(index_fd);
+    }
+    ::close(fd);
+    fd = -1;
+    return ok;
+  }
+
+private:
+  std::string path;
+  Options options;
+  int fd;
+  std::unique_ptr<FileSink> file_sink;
+  std::unique_ptr<MappedFileSink> mapped_sink;
+  Packer packer;
+  std::vector<uint64_t> offsets;
+};
+
+// Ts read lazily out of a mapping of the file, one at a time or by number. views in T
+// (std::string_view etc.) point into the mapping and last as long as the reader
+template <class T>
+class RecordReader {
+public:
+  explicit RecordReader(const std::string &path) : file(path) {
+    // a sidecar index that doesn't match the file is ignored
+    const MappedFile index(index_path(path));
+    std::optional<fixed_width<std::vector<uint64_t>>> offsets_ = unpack<fixed_width<std::vector<uint64_t>>>(index.bytes());
+    if (offsets_ && !offsets_->value.empty() && offsets_->value.front() == 0 && offsets_->value.back() == bytes().size() &&
+        std::ranges::is_sorted(offsets_->value))
+      offsets.assign(offsets_->value.begin(), offsets_->value.end());
+  }
+
+  bool is_open() const { return file.is_open(); }
+  BufferView bytes() const { return file.bytes(); }
+
+  // the next record, nullopt at the end or if it is malformed (see error())
+  std::optional<T> next() {
+    if (at_end()) return std::nullopt;
+    Unpacker unpacker(bytes().subspan(off));
+    std::optional<T> record = unpack_one<T>(unpacker);
+    if (!record) {
+      unpacker.fail(Errc::invalid);
+      error_ = {unpacker.error().code, off + unpacker.error().offset};
+      return std::nullopt;
+    }
+    off = bytes().size() - unpacker.size();
+    return record;
+  }
+
+  bool at_end() const { return off == bytes().size() || error_; }
+  const Error &error() const { return error_; }
+
+  // record k, found through the sidecar index, or else an index built by a header-only scan
+  std::optional<T> at(const size_t k) {
+    if (!index() || k + 1 >= offsets.size()) return std::nullopt;
+    return unpack<T>(bytes().subspan(offsets[k], offsets[k + 1] - offsets[k]));
+  }
+
+  // number of records, nullopt if the file doesn't split into them
+  std::optional<size_t> size() {
+    if (!index()) return std::nullopt;
+    return offsets.size() - 1;
+  }
+
+  struct sentinel {};
+
+  class iterator {
+  public:
+    const T &operator*() const { return *record; }
+    const T *operator->() const { return &*record; }
+    iterator &operator++() { record = reader->next(); return *this; }
+    bool operator==(sentinel) const { return !record; }
+
+  private:
+    friend class RecordReader;
+    iterator(RecordReader *reader) : reader(reader), record(reader->next()) {}
+
+    RecordReader *reader;
+    std::optional<T> record;
+  };
+
+  // goes on from wherever next() is, and stops early if a record is malformed
+  iterator begin() { return iterator(this); }
+  sentinel end() const { return {}; }
+
+private:
+  bool index() {
+    if (!offsets.empty()) return true;
+    if (bytes().empty()) { offsets = {0}; return true; }
+    Error error;
+    const std::optional<size_t> values_per_record = detail::values_per_record<T>(bytes(), error);
+    std::optional<std::vector<size_t>> split_ = values_per_record ? split(bytes(), *values_per_record) : std::nullopt;
+    if (split_) offsets = std::move(*split_);
+    return split_.has_value();
+  }
+
+  MappedFile file;
+  size_t off = 0;
+  Error error_;
+  std::vector<size_t> offsets;
+};
+
+}
@@ -1,13 +1,53 @@
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <string>
 
 #include "mpack.h"
+#include "mpack_async.h"
+#include "mpack_file.h"
 
 using namespace msgpack;
 
+// counts heap allocations, to check that unpack_into() stops making them, and those not yet freed,
+// to check that nothing leaks. every form of new and delete is replaced, so that none of them pairs
+// the library's with these
+std::atomic<size_t> allocations = 0;
+std::atomic<ptrdiff_t> live = 0;
+
+void *allocate(const size_t size, const size_t alignment = alignof(std::max_align_t)) {
+  allocations++;
+  void *p = alignment <= alignof(std::max_align_t) ? std::malloc(std::max<size_t>(size, 1))
+                                                   : std::aligned_alloc(alignment, (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment);
+  if (!p) throw std::bad_alloc();
+  live++;
+  return p;
+}
+
+void deallocate(void *p) {
+  if (p) live--;
+  std::free(p);
+}
+
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void *operator new(size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+
+void operator delete(void *p) noexcept { deallocate(p); }
+void operator delete[](void *p) noexcept { deallocate(p); }
+void operator delete(void *p, size_t) noexcept { deallocate(p); }
+void operator delete[](void *p, size_t) noexcept { deallocate(p); }
+void operator delete(void *p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { deallocate(p); }
+
 template <class T>
 std::ostream &operator<<(std::ostream &os, const std::vector<T> &vector) {
   os << '[';
@@ -22,6 +62,32 @@ std::ostream &operator<<(std::ostream &os, const std::vector<T> &vector) {
   return os << ']';
 }
 
+template <class A, class B>
+std::ostream &operator<<(std::ostream &os, const std::pair<A, B> &pair) {
+  return os << '(' << pair.first << ", " << pair.second << ')';
+}
+
+template <class K, class V>
+std::ostream &operator<<(std::ostream &os, const std::map<K, V> &map) {
+  os << '{';
+  bool first = true;
+  for (const auto &[k, v] : map) {
+    if (!first) os << ", ";
+    first = false;
+    os << k << ": " << v;
+  }
+  return os << '}';
+}
+
+template <class T>
+std::ostream &operator<<(std::ostream &os, const fixed_width<T> &value) {
+  return os << "fixed_width(" << value.value << ')';
+}
+
+std::ostream &operator<<(std::ostream &os, const std::chrono::system_clock::time_point &value) {
+  return os << std::chrono::duration_cast<std::chrono::nanoseconds>(value.time_since_epoch()).count() << "ns";
+}
+
 template <class ...Ts>
 Buffer bytes(Ts... bytes) { return {std::byte(bytes)...}; }
 
@@ -47,6 +113,9 @@ bool test(T value, const Buffer &expected) {
   if (packed != expected) {
     std::cout << "pack(" << value << ") -> " << packed_str << ", expected " << to_string(expected) << std::endl << std::endl;
     return false;
+  } else if (packed_size(value) != packed.size()) {
+    std::cout << "packed_size(" << value << ") -> " << packed_size(value) << ", expected " << packed.size() << std::endl << std::endl;
+    return false;
   } else {
     std::cout << "pack(" << value << ") -> " << packed_str << std::endl;
   }
@@ -91,15 +160,99 @@ define_unpack(vec3) {
   };
 }
 
+define_unpack_into(vec3) {
+  do_unpack_into(value.x);
+  do_unpack_into(value.y);
+  do_unpack_into(value.z);
+  return true;
+}
+
+struct rgb {
+  uint8_t r, g, b;
+  bool operator==(const rgb &) const = default;
+};
+
+template<> struct msgpack::ext<rgb> {
+  static constexpr int8_t type = 5;
+  static size_t size(const rgb &) { return 3; }
+  static void put(std::byte *out, const rgb &value) { std::memcpy(out, &value, 3); }
+  static bool get(const BufferView &payload, rgb &value) {
+    if (payload.size() != 3) return false;
+    std::memcpy(&value, payload.data(), 3);
+    return true;
+  }
+};
+
+define_ext(rgb);
+
+std::ostream &operator<<(std::ostream &os, const rgb &value) {
+  return os << "rgb(" << +value.r << ", " << +value.g << ", " << +value.b << ')';
+}
+
 std::ostream &operator<<(std::ostream &os, const vec3 &value) {
   return os << "{ .x = " << value.x << ", .y = \"" << value.y << "\", .z = " << value.z << " }";
 }
 
+struct sample {
+  double t;
+  fixed_width<int32_t> id;
+  std::array<float, 3> xyz;
+  bool ok;
+
+  bool operator==(const sample &) const = default;
+};
+
+define_aggregate(sample);
+
+struct labeled {
+  std::string label;
+  sample s;
+  std::vector<sample> history;
+
+  bool operator==(const labeled &) const = default;
+};
+
+define_aggregate(labeled);
+
+struct note {
+  std::pmr::string text;
+  std::pmr::vector<std::pmr::string> tags;
+
+  bool operator==(const note &) const = default;
+};
+
+define_aggregate(note);
+
+struct six {
+  fixed_width<uint16_t> a;
+  float b;
+  double c;
+  bool d;
+  fixed_width<int64_t> e;
+  float f;
+
+  bool operator==(const six &) const = default;
+};
+
+define_aggregate(six);
+
+struct sixteen {
+  int a, b, c, d, e, f, g, h, i, j, k, l, m, n;
+  std::string o;
+  std::vector<double> p;
+
+  bool operator==(const sixteen &) const = default;
+};
+
+define_aggregate(sixteen);
+
 int main() {
   assert(test<bool>(true, bytes(0xc3)));
   assert(test<bool>(false, bytes(0xc2)));
   assert(test<uint64_t>(3, bytes(0x03)));
   assert(test<int>(-3, bytes(0xfd)));
+  assert(test<int>(-129, bytes(0xd1, 0xff, 0x7f)));
+  assert(test<int64_t>(-(int64_t{1} << 31) - 1, bytes(0xd3, 0xff, 0xff, 0xff, 0xff, 0x7f, 0xff, 0xff, 0xff)));
   assert(test<std::nullptr_t>(nullptr, bytes(0xc0)));
   assert(test<float>(3.14159f, bytes(0xca, 0x40, 0x49, 0x0f, 0xd0)));
   assert(test<double>(3.14159265358979, bytes(0xcb, 0x40, 0x09, 0x21, 0xfb, 0x54, 0x44, 0x2d, 0x11)));
@@ -118,13 +271,726 @@ int main() {
                                  0x6f, 0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76,
                                  0x77, 0x78, 0x79, 0x7a, 0x61, 0x62, 0x63, 0x64,
                                  0x65, 0x66)));
-  // str 16 and str 32 are not tested for undisclosed reasons
+  // 300 chars (str 16) and 70000 chars (str 32)
+  for (const auto &[length, header] : {std::pair{size_t{300}, bytes(0xda, 0x01, 0x2c)}, std::pair{size_t{70000}, bytes(0xdb, 0x00, 0x01, 0x11, 0x70)}}) {
+    const std::string long_string(length, 'x');
+    const Buffer packed = pack(long_string);
+    assert(packed.size() == header.size() + length && std::ranges::equal(BufferView(packed).first(header.size()), header));
+    assert(unpack<std::string>(packed) == long_string);
+  }
+  assert(!unpack<std::string>(pack(-1)));
+  assert(!unpack<std::string>(bytes(0xa3, 0x61)));
   assert(test<std::vector<uint8_t>>({}, bytes(0xc4, 0x00)));
   assert(test<std::vector<uint8_t>>({1, 2, 3, 4, 5, 6, 7, 8}, bytes(0xc4, 0x08, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08)));
-  // bin 16 and bin 32 are not tested for undisclosed reasons
+  // 300 bytes (bin 16) and 70000 bytes (bin 32)
+  for (const auto &[length, header] : {std::pair{size_t{300}, bytes(0xc5, 0x01, 0x2c)}, std::pair{size_t{70000}, bytes(0xc6, 0x00, 0x01, 0x11, 0x70)}}) {
+    const std::vector<uint8_t> blob(length, 7);
+    const Buffer packed = pack(blob);
+    assert(packed.size() == header.size() + length && std::ranges::equal(BufferView(packed).first(header.size()), header));
+    assert(unpack<std::vector<uint8_t>>(packed) == blob);
+  }
+  assert(!unpack<std::vector<uint8_t>>(bytes(0xc5, 0x01)));
+  assert(!unpack<double>(bytes(0xcb, 0x40, 0x09)));
+  assert(test<std::vector<int>>({1, -1, 300}, bytes(0x93, 0x01, 0xff, 0xcd, 0x01, 0x2c)));
+  assert(test<std::vector<float>>({1.25f, -2.0f}, bytes(0x92, 0xca, 0x3f, 0xa0, 0x00, 0x00, 0xca, 0xc0, 0x00, 0x00, 0x00)));
+  assert(test<std::vector<std::string>>({"a", "bc"}, bytes(0x92, 0xa1, 0x61, 0xa2, 0x62, 0x63)));
+  assert((test<std::pair<bool, std::nullptr_t>>({true, nullptr}, bytes(0x92, 0xc3, 0xc0))));
+  assert((test<std::map<std::string, int>>({{"a", 1}, {"b", -2}}, bytes(0x82, 0xa1, 0x61, 0x01, 0xa1, 0x62, 0xfe))));
+  assert((!unpack<std::map<int, int>>(bytes(0x82, 0x01, 0x01, 0x01, 0x02))));
+  assert(!unpack<std::vector<int>>(bytes(0xdd, 0xff, 0xff, 0xff, 0xff)));
+  assert(!unpack<std::vector<float>>(bytes(0x91, 0xcb, 0x3f, 0xa0, 0x00, 0x00)));
+  {
+    std::vector<double> samples(20000);
+    for (size_t i = 0; i < samples.size(); i++) samples[i] = i * 0.5;
+    const Buffer packed = pack(samples);
+    assert(packed.size() == 3 + 9 * samples.size() && packed[0] == format::array_16 && packed[3] == format::float_64);
+    assert(unpack<std::vector<double>>(packed) == samples);
+    assert((unpack<std::array<double, 2>>(pack(std::array<double, 2>{1, 2})) == std::array<double, 2>{1, 2}));
+    assert((!unpack<std::array<double, 3>>(pack(std::array<double, 2>{1, 2}))));
+    assert((unpack<std::unordered_map<int, std::vector<float>>>(pack(std::unordered_map<int, std::vector<float>>{{1, {2}}}))->at(1) == std::vector<float>{2}));
+  }
+  // every kernel set must agree with the scalar one, including around the simd block sizes
+  for (const detail::Kernels *kernels : detail::supported_kernels()) {
+    detail::kernels() = kernels;
+    for (size_t n = 0; n < 20; n++) {
+      std::vector<float> floats(n);
+      std::vector<double> doubles(n);
+      fixed_width<std::vector<int32_t>> ints{std::vector<int32_t>(n)};
+      fixed_width<std::vector<uint64_t>> longs{std::vector<uint64_t>(n)};
+      for (size_t i = 0; i < n; i++) {
+        floats[i] = i * -1.5f;
+        doubles[i] = i * 1e100;
+        ints.value[i] = static_cast<int32_t>(i * 0x01020304) - 7;
+        longs.value[i] = i * 0x0102030405060708;
+      }
+      detail::kernels() = &detail::scalar_kernels;
+      const Buffer expected = pack(floats, doubles, ints, longs);
+      detail::kernels() = kernels;
+      assert(pack(floats, doubles, ints, longs) == expected);
+      assert((unpack<std::vector<float>, std::vector<double>, fixed_width<std::vector<int32_t>>, std::vector<uint64_t>>(expected)
+              == std::tuple{floats, doubles, ints, longs.value}));
+      if (n > 0) {
+        // wrong format byte in the last record
+        Buffer broken = pack(floats);
+        broken[broken.size() - 5] = format::float_64;
+        assert(!unpack<std::vector<float>>(broken));
+      }
+    }
+  }
+  detail::kernels() = detail::supported_kernels().back();
+  assert(test<fixed_width<int16_t>>({5}, bytes(0xd1, 0x00, 0x05)));
+  assert(unpack<fixed_width<uint32_t>>(pack(5))->value == 5);
+  assert(test<fixed_width<std::string>>({"ab"}, bytes(0xdb, 0x00, 0x00, 0x00, 0x02, 0x61, 0x62)));
+  assert(unpack<fixed_width<std::string_view>>(pack(std::string_view("ab")))->value == "ab");
+  assert(unpack<std::vector<int16_t>>(pack(fixed_width<std::vector<int16_t>>{{1, -1}})) == (std::vector<int16_t>{1, -1}));
+
   assert(test<vec3>({1.25, "727", 0}, bytes(0xca, 0x3f, 0xa0, 0x00, 0x00, 0xa3, 0x37, 0x32, 0x37, 0x00)));
 
   assert(!unpack<uint32_t>(pack(-7)));
+  assert(!unpack<uint64_t>(pack(-32)));
+  assert(unpack<int64_t>(pack(std::numeric_limits<int64_t>::min())) == std::numeric_limits<int64_t>::min());
+  assert(unpack<int64_t>(pack(uint64_t{1} << 62)) == int64_t{1} << 62);
+  assert(!unpack<int64_t>(pack(uint64_t{1} << 63)));
+  assert(unpack<int8_t>(pack(-128)) == -128 && !unpack<int8_t>(pack(-129)) && !unpack<int8_t>(pack(128)));
+  assert(unpack<uint16_t>(bytes(0xd0, 0x05)) == 5);
+  assert(!unpack<int>(bytes(0xc1)) && !unpack<int>(bytes(0xcd, 0x01)));
+
+  // views
+  {
+    const Buffer packed = pack(std::string("hello"), std::vector<uint8_t>{1, 2, 3});
+    const auto views = unpack<std::string_view, std::span<const uint8_t>>(packed);
+    assert(views);
+    const auto &[s, b] = *views;
+    assert(s == "hello" && reinterpret_cast<const std::byte *>(s.data()) == &packed[1]);
+    assert(b.size() == 3 && b[2] == 3 && reinterpret_cast<const std::byte *>(b.data()) == &packed[8]);
+    assert(unpack<BufferView>(pack(BufferView(packed)))->size() == packed.size());
+  }
+
+  // streaming
+  {
+    using Stream = StreamUnpacker<std::string, double>;
+    const Buffer packed = pack(std::string("first"), 1.5, std::string("second"), 2.5, std::string("third"), 3.5);
+    Stream stream;
+    std::vector<std::string> names;
+    // dribble in 4 bytes at a time
+    for (size_t off = 0; off < packed.size(); off += 4) {
+      stream.feed(BufferView(packed).subspan(off, std::min<size_t>(4, packed.size() - off)));
+      Stream::Status status;
+      while ((status = stream.next()) == Stream::Status::ok) names.push_back(std::get<0>(stream.get()));
+      assert(status == Stream::Status::incomplete && stream.needed() > 0);
+    }
+    assert((names == std::vector<std::string>{"first", "second", "third"}));
+    assert(stream.consumed() == packed.size());
+
+    Stream broken;
+    const Buffer garbage = bytes(0xa1, 0x61, 0xc3);
+    broken.feed(garbage);
+    assert(broken.next() == Stream::Status::invalid);
+
+    StreamUnpacker<double> partial;
+    const Buffer truncated = bytes(0xcb, 0x40);
+    partial.feed(truncated);
+    assert(partial.next() == StreamUnpacker<double>::Status::incomplete && partial.needed() == 7);
+    const Buffer rest = bytes(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+    partial.feed(rest);
+    assert(partial.next() == StreamUnpacker<double>::Status::ok && partial.get() == 2.0 && partial.needed() == 0);
+
+    // views never point into a chunk that has since been reused, e.g. the first string, which is all
+    // in the first chunk while its message isn't
+    using Views = StreamUnpacker<std::string_view, uint32_t>;
+    std::string text;
+    for (size_t i = 0; i < 200; i++) text += static_cast<char>('a' + i % 26);
+    const Buffer messages = pack(text.substr(0, 20), 1u, std::string("y"), 2u, text, 3u);
+    Views views;
+    std::vector<std::pair<std::string, uint32_t>> seen;
+    Buffer chunk;
+    for (size_t off = 0, i = 0, n; off < messages.size(); off += n, i++) {
+      n = std::min<size_t>(std::array{21, 3, 100}[i % 3], messages.size() - off);
+      chunk.assign(messages.begin() + off, messages.begin() + off + n);
+      views.feed(chunk);
+      while (views.next() == Views::Status::ok) seen.emplace_back(std::get<0>(views.get()), std::get<1>(views.get()));
+      std::ranges::fill(chunk, std::byte{0xc1});
+    }
+    assert((seen == std::vector<std::pair<std::string, uint32_t>>{{text.substr(0, 20), 1}, {"y", 2}, {text, 3}}));
+  }
+
+  // views
+  {
+    const Buffer packed = pack(std::string("route"), std::map<std::string, int>{{"a", 1}}, std::vector<double>{1, 2}, 7);
+    View view(packed);
+    assert(view.size() == 4);
+    assert(view.type(0) == Type::str && view.type(1) == Type::map && view.type(2) == Type::array && view.type(3) == Type::int_);
+    assert(view.get<std::string_view>(0) == "route" && view.get<int>(3) == 7 && !view.get<int>(0) && !view.at(4));
+
+    Cursor cursor = view.cursor();
+    assert(cursor.skip() && cursor.skip() && cursor.peek_type() == Type::array);
+    View array = *cursor.enter();
+    assert(array.size() == 2 && array.get<double>(1) == 2.0);
+    assert(cursor.read<int>() == 7 && cursor.at_end());
+
+    assert(!View(BufferView(packed).first(packed.size() - 2)).size());
+    assert(!View(bytes(0xc1)).size());
+  }
+
+  // sizes
+  static_assert(packed_size(nullptr, true, 1.0f, 1.0) == 16);
+  static_assert(packed_size(uint64_t{1} << 40, int8_t{-100}) == 11);
+  static_assert(fixed_size<double> && !fixed_size<uint32_t> && max_packed_size<uint32_t> == 5);
+  assert(packed_size(std::string(300, 'a'), std::vector<uint8_t>(70000)) == 303 + 70005);
+  // falls back to counting since vec3 has no define_packed_size(), and so pack() doesn't size it first
+  assert(packed_size(vec3{1.25, "727", 0}) == 10);
+  static_assert(!presizable<vec3> && !presizable<std::vector<vec3>> && presizable<std::vector<std::string>> && presizable<uint32_t>);
+
+  // sinks
+  {
+    Buffer buffer = pack(true);
+    assert(pack_into(buffer, std::string("a"), 3));
+    assert(buffer == bytes(0xc3, 0xa1, 0x61, 0x03));
+  }
+  {
+    Packer packer;
+    pack_one(packer, 727);
+    const Packer &view = packer;
+    assert(view.get() == bytes(0xcd, 0x02, 0xd7));
+    pack_one(packer, true);
+    assert(view.get() == bytes(0xcd, 0x02, 0xd7, 0xc3) && view.size() == 4);
+  }
+  {
+    std::array<std::byte, 4> storage;
+    SpanSink sink(storage);
+    assert(pack_into(sink, 1.25f) == false);
+    assert(sink.overflowed() && sink.size() == 4);
+    assert(Buffer(storage.begin(), storage.end()) == bytes(0xca, 0x3f, 0xa0, 0x00));
+  }
+  {
+    std::array<std::byte, 3> a, b, c;
+    const std::array<std::span<std::byte>, 3> segments{a, b, c};
+    ScatterSink sink(segments);
+    assert(pack_into(sink, 1.25f));
+    assert(sink.size() == 5 && sink.count() == 2);
+    Buffer gathered;
+    for (size_t i = 0; i < sink.count(); i++) gathered.insert(gathered.end(), sink.filled(i).begin(), sink.filled(i).end());
+    assert(gathered == bytes(0xca, 0x3f, 0xa0, 0x00, 0x00));
+  }
+  {
+    std::array<std::byte, 8> ring;
+    RingSink sink(ring, 6, 5);
+    assert(pack_into(sink, std::string("abcd")));
+    assert(sink.next_head() == 3);
+    assert(Buffer(ring.begin() + 6, ring.end()) == bytes(0xa4, 0x61));
+    assert(Buffer(ring.begin(), ring.begin() + 3) == bytes(0x62, 0x63, 0x64));
+    RingSink oversized(ring, 0, 9);
+    assert(!pack_into(oversized, true) && oversized.size() == 0);
+  }
+
+  // aggregates
+  {
+    static_assert(fixed_size<sample> && max_packed_size<sample> == 9 + 5 + 16 + 1);
+    static_assert(!fixed_size<labeled> && min_packed_size<labeled> == 1 + 31 + 1);
+    const sample s{0.5, {-7}, {1, 2, 3}, true};
+    assert(pack(s) == pack(s.t, s.id, s.xyz, s.ok));
+    assert(unpack<sample>(pack(s)) == s);
+    // not packed by a fused codec, so the ints are narrow
+    assert(unpack<sample>(pack(s.t, -7, s.xyz, s.ok)) == s);
+    assert(!unpack<sample>(pack(s.t, s.id, s.xyz, 1)));
+
+    const labeled l{"abc", s, {s, {1.5, {1 << 20}, {}, false}}};
+    assert(pack(l) == pack(l.label, l.s, l.history));
+    assert(packed_size(l) == pack(l).size());
+    assert(unpack<labeled>(pack(l)) == l);
+    assert(unpack_trusted<labeled>(pack(l)) == l);
+
+    // as many fields as there are names for, and then some
+    const six x{{7}, 1.5f, -2.5, true, {-1}, 3.0f};
+    static_assert(fixed_size<six> && max_packed_size<six> == 3 + 5 + 9 + 1 + 9 + 5);
+    assert(pack(x) == pack(x.a, x.b, x.c, x.d, x.e, x.f) && unpack<six>(pack(x)) == x);
+    const sixteen y{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, -14, "fifteen", {16.0}};
+    static_assert(!fixed_size<sixteen> && min_packed_size<sixteen> == 14 + 1 + 1);
+    assert(pack(y) == pack(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, -14, y.o, y.p));
+    assert(packed_size(y) == pack(y).size() && unpack<sixteen>(pack(y)) == y);
+  }
+
+  // elements that pack to several values are an array each, so a container is still one value
+  {
+    const std::vector<vec3> vecs{{1, "a", 2}, {3, "b", 4}};
+    const Buffer packed = pack(vecs);
+    assert(packed == pack(array_header{2}, array_header{3}, 1.0f, std::string_view("a"), 2, array_header{3}, 3.0f, std::string_view("b"), 4));
+    assert(!validate(packed) && View(packed).size() == 1 && packed_size(vecs) == packed.size());
+    assert(unpack<std::vector<vec3>>(packed) == vecs);
+    // not as an array of the right length
+    assert(!unpack<std::vector<vec3>>(pack(array_header{1}, 1.0f, std::string_view("a"), 2)));
+    assert(!unpack<std::vector<vec3>>(pack(array_header{1}, array_header{2}, 1.0f, std::string_view("a"))));
+
+    // aggregates, down the bulk path for raw ones, and in pairs and maps
+    const sample s{0.5, {-7}, {1, 2, 3}, true};
+    static_assert(fixed_size<std::array<sample, 2>> && max_packed_size<std::array<sample, 2>> == 1 + 2 * (1 + max_packed_size<sample>));
+    assert(pack(std::array{s, s}) == pack(array_header{2}, array_header{4}, s, array_header{4}, s));
+    assert((unpack<std::array<sample, 2>>(pack(std::array{s, s})) == std::array{s, s}));
+    assert(pack(std::vector{s}) == pack(array_header{1}, array_header{4}, s));
+    const std::pair<int, vec3> pair{7, vecs[0]};
+    assert((pack(pair) == pack(array_header{2}, 7, array_header{3}, vecs[0]) && unpack<std::pair<int, vec3>>(pack(pair)) == pair));
+    const std::map<std::string, sample> map{{"a", s}, {"b", s}};
+    assert(!validate(pack(map)) && View(pack(map)).size() == 1 && packed_size(map) == pack(map).size());
+    assert((unpack<std::map<std::string, sample>>(pack(map)) == map));
+    // aggregate fields that are aggregates are still packed flat
+    static_assert(detail::static_values<labeled>() == 1 + 4 + 1);
+  }
+
+  // unpacking into existing values
+  {
+    using Message = std::pair<std::vector<vec3>, std::map<std::string, labeled>>;
+    const sample s{0.5, {-7}, {1, 2, 3}, true};
+    const Message big{{{1, "longer than any small string buffer", 2}, {3, "x", 4}},
+                      {{"first key, also quite long", {"label", s, {s, s, s}}}, {"b", {"", s, {s}}}}};
+    const Message other{{{7, "same shape, different values", 8}, {9, "z", 10}},
+                        {{"different keys", {"label", s, {s, s}}}, {"a", {"x", s, {s}}}}};
+    const Message small{{{5, "y", 6}}, {{"c", {"another label", s, {s}}}}};
+    const Buffer packed_big = pack(big), packed_other = pack(other), packed_small = pack(small);
+
+    Message message;
+    assert(unpack_into(packed_big, message) && message == big);
+    // from here on it's all overwriting what's there
+    const size_t warm = allocations;
+    assert(unpack_into(packed_other, message) && message == other);
+    assert(unpack_into(packed_small, message) && message == small);
+    assert(allocations == warm);
+
+    // growing back after shrinking allocates for what was dropped, and only that: the vector
+    // keeps its buffer, but not its strings past the new size, and the map frees leftover nodes
+    const std::string longer(40, 'x');
+    std::vector<std::string> strings;
+    const Buffer three = pack(std::vector{longer, longer, longer}), one = pack(std::vector{longer});
+    assert(unpack_into(three, strings) && unpack_into(one, strings));
+    size_t before = allocations;
+    assert(unpack_into(three, strings) && allocations == before + 2);
+    std::map<std::string, std::string> map;
+    const Buffer entries = pack(std::map<std::string, std::string>{{longer + "a", longer}, {longer + "b", longer}, {longer + "c", longer}});
+    const Buffer entry = pack(std::map<std::string, std::string>{{longer + "a", longer}});
+    assert(unpack_into(entries, map) && unpack_into(entry, map));
+    before = allocations;
+    // a node, a key and a value for each of the two entries dropped
+    assert(unpack_into(entries, map) && allocations == before + 2 * 3);
+    before = allocations;
+    assert(unpack_into(entries, map) && allocations == before);
+
+    Error error;
+    assert(!unpack_into(pack(1), message, error) && error == (Error{Errc::type_mismatch, 0}));
+    assert(unpack_into(packed_small, message) && message == small);
+  }
+
+  // memory resources
+  {
+    using Notes = std::pmr::map<std::pmr::string, note>;
+    const std::pmr::string text = "a string too long to be stored inline";
+    Notes notes;
+    notes.emplace(text, note{text, {text, "x"}});
+    notes.emplace("b", note{"", {}});
+    const Buffer packed = pack(notes);
+
+    Arena arena(packed.size(), std::pmr::new_delete_resource());
+    // anything not from the arena would throw
+    std::pmr::memory_resource *const fallback = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    const size_t before = allocations;
+    const std::optional<Notes> unpacked = unpack<Notes>(packed, &arena);
+    // the arena's one block, from its upstream resource
+    assert(allocations == before + 1);
+    std::pmr::set_default_resource(fallback);
+    assert(unpacked == notes);
+    const auto &[key, value] = *unpacked->begin();
+    assert(unpacked->get_allocator().resource() == &arena && key.get_allocator().resource() == &arena);
+    assert(value.text.get_allocator().resource() == &arena && value.tags[0].get_allocator().resource() == &arena);
+  }
+
+  // batches
+  {
+    std::vector<vec3> records(1000);
+    for (size_t i = 0; i < records.size(); i++) records[i] = {i * 0.5f, std::string(i % 40, 'a'), static_cast<uint8_t>(i)};
+    Buffer sequential;
+    for (const vec3 &record : records) pack_into(sequential, record);
+    for (const unsigned threads : {1u, 4u}) {
+      const Buffer packed = pack_batch(records, threads);
+      assert(packed == sequential);
+      assert(unpack_batch<vec3>(packed, threads) == records);
+    }
+    assert(split(sequential, 3)->size() == records.size() + 1);
+    assert(unpack_batch<vec3>(Buffer{})->empty());
+
+    // the 101st record has a bool for z
+    Buffer corrupt = sequential;
+    const size_t at = (*split(sequential, 3))[100] + packed_size(records[100].x, records[100].y);
+    corrupt[at] = format::true_;
+    Error error;
+    assert(!unpack_batch<vec3>(corrupt, error, 4) && error == (Error{Errc::type_mismatch, at}));
+    assert(!unpack_batch<vec3>(BufferView(sequential).first(sequential.size() - 1), error, 4) && error.code == Errc::truncated);
+
+    // each vec3 in a vector is an array of its own, so records of those split like any other
+    const std::vector<std::vector<vec3>> shapes{{records[1]}, {}, {records[2], records[3]}};
+    assert(unpack_batch<std::vector<vec3>>(pack_batch(shapes, 1), error, 1) == shapes);
+  }
+
+  // errors and trusted unpacking
+  {
+    Error error;
+    assert(!unpack<std::string>(bytes(0x92, 0x01), error) && error == (Error{Errc::type_mismatch, 0}));
+    assert(!unpack<std::vector<int>>(bytes(0x92, 0x01, 0xa1, 0x61), error) && error == (Error{Errc::type_mismatch, 2}));
+    assert(!unpack<uint8_t>(bytes(0x01, 0xcd, 0x01, 0x00), error) && error == (Error{Errc::trailing_bytes, 1}));
+    assert(!unpack<uint8_t>(bytes(0xcd, 0x01, 0x00), error) && error == (Error{Errc::out_of_range, 0}));
+    assert(!unpack<std::string>(bytes(0xa3, 0x61), error) && error == (Error{Errc::truncated, 1}));
+    assert(!unpack<bool>(bytes(0xc1), error) && error == (Error{Errc::invalid, 0}));
+    assert(unpack<bool>(bytes(0xc3), error) && !error);
+
+    using Map = std::map<std::string, std::vector<double>>;
+    const Buffer packed = pack(Map{{"a", {1.5, -2}}});
+    assert(!validate(packed));
+    assert(unpack_trusted<Map>(packed) == (Map{{"a", {1.5, -2}}}));
+    assert(validate(BufferView(packed).first(packed.size() - 3)) == (Error{Errc::truncated, 13}));
+    assert(validate(bytes(0x92, 0x01)) == (Error{Errc::truncated, 2}));
+    assert(validate(bytes(0x01, 0xc1)) == (Error{Errc::invalid, 1}));
+
+    // types are still checked, format bytes still bounds checked
+    assert(unpack_trusted<std::vector<float>>(pack(std::vector<double>{1, 2})) == std::nullopt);
+    assert(unpack_trusted<std::vector<double>>(pack(std::vector<int>{1, 2})) == std::nullopt);
+    assert(unpack_trusted<vec3>(pack(1.25f)) == std::nullopt);
+    assert(unpack_trusted<vec3>(pack(vec3{1.25, "727", 0})) == (vec3{1.25, "727", 0}));
+  }
+
+  // timestamps and other ext types
+  {
+    using namespace std::chrono;
+    using Time = system_clock::time_point;
+    assert(test(Time(seconds(1)), bytes(0xd6, 0xff, 0x00, 0x00, 0x00, 0x01)));
+    assert(test(Time(milliseconds(1500)), bytes(0xd7, 0xff, 0x77, 0x35, 0x94, 0x00, 0x00, 0x00, 0x00, 0x01)));
+    assert(test(Time(nanoseconds(-1)), bytes(0xc7, 0x0c, 0xff, 0x3b, 0x9a, 0xc9, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff)));
+    // past 2106, the 32-bit form runs out
+    assert(pack(Time(seconds(int64_t{1} << 32))).size() == 10);
+    assert(pack(time_point<system_clock, seconds>(seconds(int64_t{1} << 34))).size() == 15);
+    for (const Time t : {Time{}, Time(seconds(1'700'000'000) + nanoseconds(727)), Time(hours(-1'000'000))}) {
+      assert(unpack<Time>(pack(t)) == t && packed_size(t) == pack(t).size());
+    }
+    assert(unpack<nanoseconds>(pack(nanoseconds(-727))) == nanoseconds(-727));
+    assert((unpack<time_point<system_clock, seconds>>(pack(Time(seconds(727)))) == time_point<system_clock, seconds>(seconds(727))));
+    // durations coarser than a second, and finer than a nanosecond
+    assert(unpack<hours>(pack(hours(2))) == hours(2) && unpack<hours>(pack(hours(-1'000'000))) == hours(-1'000'000));
+    assert((unpack<time_point<system_clock, hours>>(pack(Time(hours(727)))) == time_point<system_clock, hours>(hours(727))));
+    assert((unpack<duration<int64_t, std::pico>>(pack(nanoseconds(727))) == duration<int64_t, std::pico>(727'000)));
+    assert(unpack<duration<int32_t>>(pack(seconds(-727))) == duration<int32_t>(-727));
+
+    Error error;
+    // nanoseconds past a second, a time that doesn't fit in nanoseconds, ext of another type
+    assert(!unpack<Time>(bytes(0xd7, 0xff, 0xff, 0xff, 0xff, 0xfc, 0x00, 0x00, 0x00, 0x00), error) && error == (Error{Errc::invalid, 0}));
+    assert(!unpack<Time>(pack(time_point<system_clock, seconds>(seconds(int64_t{1} << 40))), error) && error.code == Errc::invalid);
+    // times a coarser duration can't hold exactly, rather than truncated to one it can
+    assert(!unpack<hours>(pack(seconds(5400)), error) && error.code == Errc::invalid);
+    assert(!unpack<milliseconds>(pack(nanoseconds(1'500'001)), error) && error.code == Errc::invalid);
+    assert(!unpack<duration<int32_t>>(pack(seconds(int64_t{1} << 32)), error) && error.code == Errc::invalid);
+    assert((!unpack<duration<int64_t, std::pico>>(pack(seconds(int64_t{1} << 30)), error) && error.code == Errc::invalid));
+    assert(!unpack<Time>(bytes(0xd6, 0x01, 0x00, 0x00, 0x00, 0x01), error) && error == (Error{Errc::type_mismatch, 0}));
+    assert(!unpack<Time>(bytes(0xd6, 0xff, 0x00), error) && error.code == Errc::truncated);
+
+    assert(test(rgb{1, 2, 3}, bytes(0xc7, 0x03, 0x05, 0x01, 0x02, 0x03)));
+    assert(!validate(pack(rgb{1, 2, 3}, Time(seconds(1)))));
+  }
+
+  // interning
+  {
+    std::vector<std::pair<std::string, double>> ticks;
+    for (size_t i = 0; i < 1000; i++) ticks.push_back({"sym" + std::to_string(i % 10), i * 0.5});
+    const Buffer packed = pack(ticks);
+
+    Interner interner(8);
+    using Ticks = std::vector<std::pair<interned, double>>;
+    const std::optional<Ticks> unpacked = unpack<Ticks>(packed, interner);
+    assert(unpacked && unpacked->size() == ticks.size());
+    for (size_t i = 0; i < ticks.size(); i++) assert((*unpacked)[i].first.view == ticks[i].first && (*unpacked)[i].second == ticks[i].second);
+    // sym0 to sym7 are stored once each, sym8 and sym9 find the table full every time
+    assert(interner.size() == 8 && interner.stats().hits == 792 && interner.stats().misses == 208);
+    assert((*unpacked)[3].first == (*unpacked)[13].first && (*unpacked)[3].first.view.data() == (*unpacked)[13].first.view.data());
+    assert((*unpacked)[8].first.id == interned::none && (*unpacked)[8].first == (*unpacked)[18].first && interner.get(3) == "sym3");
+
+    // once they are all in, the only allocation left is the vector
+    const size_t before = allocations;
+    assert(unpack<Ticks>(packed, interner));
+    assert(allocations == before + 1);
+
+    assert(Interner(16, 4).intern("toolong").id == interned::none);
+    assert(unpack<interned>(pack(std::string_view("727")))->view == "727");
+
+    // stored handles outlive the chunks they came from, misses view the chunk like std::string_view
+    StreamUnpacker<interned> stream(interner);
+    Buffer chunk = pack(std::string("sym1"), std::string("sym9"), std::string(100, 'x'));
+    stream.feed(chunk);
+    assert(stream.next() == decltype(stream)::Status::ok);
+    const interned sym1 = stream.get();
+    assert(stream.next() == decltype(stream)::Status::ok);
+    const interned sym9 = stream.get();
+    assert(stream.next() == decltype(stream)::Status::ok);
+    const interned long_ = stream.get();
+    assert(sym9.id == interned::none && long_.id == interned::none);
+    assert(sym9.view.data() > reinterpret_cast<const char *>(chunk.data()) && long_.view.data() < reinterpret_cast<const char *>(chunk.data() + chunk.size()));
+    std::ranges::fill(chunk, std::byte{0});
+    assert(sym1.view == "sym1" && sym1 == (*unpacked)[1].first);
+  }
+
+  // constant messages
+  {
+    constexpr auto heartbeat = pack_static<array_header{3}, fixed_string("hb"), 727u, std::pair{-40000, 1.5f}>();
+    static_assert(heartbeat.size() == 1 + 3 + 3 + 1 + 5 + 5);
+    static_assert(heartbeat[0] == (format::fixarray | std::byte{3}) && heartbeat[4] == format::uint_16);
+    assert(std::ranges::equal(heartbeat, pack(array_header{3}, std::string_view("hb"), 727u, std::pair{-40000, 1.5f})));
+    assert((unpack<array_header, std::string, uint32_t, std::pair<int, float>>(heartbeat) ==
+            std::tuple{array_header{3}, std::string("hb"), 727u, std::pair{-40000, 1.5f}}));
+
+    // the constant part once, the rest per message
+    constexpr auto prefix = pack_static<map_header{2}, fixed_string("op"), fixed_string("put"), fixed_string("key")>();
+    const Buffer message = pack_with_prefix(prefix, std::string("727"));
+    assert((unpack<std::map<std::string, std::string>>(message) == std::map<std::string, std::string>{{"op", "put"}, {"key", "727"}}));
+  }
+
+  // record files
+  {
+    using Record = std::pair<std::string, double>;
+    std::vector<Record> records(500);
+    for (size_t i = 0; i < records.size(); i++) records[i] = {std::string(i % 50, 'r'), i * 0.25};
+    const std::string path = "/tmp/mpack_test_" + std::to_string(::getpid()) + ".rec";
+    Buffer expected;
+    for (const Record &record : records) pack_into(expected, record);
+
+    for (const bool mapped : {false, true}) {
+      {
+        RecordWriter<Record> writer(path, {.mapped = mapped, .flush_size = 64, .index = mapped});
+        assert(writer.is_open());
+        for (const Record &record : records) assert(writer.write(record));
+        assert(writer.size() == expected.size() && writer.close());
+      }
+
+      RecordReader<std::pair<std::string_view, double>> reader(path);
+      assert(reader.is_open() && std::ranges::equal(reader.bytes(), expected));
+      size_t i = 0;
+      for (const auto &[name, value] : reader) {
+        assert(name == records[i].first && value == records[i].second);
+        // zero copy: the view points into the mapping
+        assert(name.empty() || (name.data() >= reinterpret_cast<const char *>(reader.bytes().data()) &&
+                                name.data() < reinterpret_cast<const char *>(reader.bytes().data() + reader.bytes().size())));
+        i++;
+      }
+      assert(i == records.size() && reader.at_end() && !reader.error());
+      assert(reader.size() == records.size() && reader.at(0)->first == "" && reader.at(427)->first == records[427].first);
+      assert(!reader.at(records.size()));
+    }
+
+    // rewritten to the same length without an index, the old one doesn't survive to point at
+    // records that are no longer there
+    {
+      RecordWriter<Record> writer(path, {.index = true});
+      writer.write({"ab", 1});
+      writer.write({"c", 2});
+    }
+    {
+      RecordWriter<Record> writer(path);
+      writer.write({"a", 1});
+      writer.write({"bc", 2});
+    }
+    assert(RecordReader<Record>(path).at(1) == (Record{"bc", 2}));
+
+    // an index gone stale some other way is ignored
+    {
+      RecordWriter<Record> writer(path, {.index = true});
+      writer.write({"ab", 1});
+      writer.write({"c", 2});
+    }
+    const Buffer one = pack(Record{"727", 1});
+    const int fd = ::open(path.c_str(), O_WRONLY | O_TRUNC);
+    assert(::write(fd, one.data(), one.size()) == static_cast<ssize_t>(one.size()) && ::close(fd) == 0);
+    RecordReader<Record> reader(path);
+    assert(reader.size() == 1 && reader.at(0) == (Record{"727", 1}) && reader.next() == (Record{"727", 1}) && !reader.next());
+
+    { RecordWriter<std::string>(path).write("abc"); }
+    RecordReader<Record> mismatched(path);
+    assert(!mismatched.next() && mismatched.at_end() && mismatched.error() == (Error{Errc::type_mismatch, 0}));
+    std::remove(path.c_str());
+    std::remove(index_path(path).c_str());
+    assert(!RecordReader<Record>(path).is_open());
+  }
+
+  // async streams
+  {
+    std::vector<labeled> values(2000);
+    for (size_t i = 0; i < values.size(); i++) {
+      const sample s{i * 0.25, {static_cast<int32_t>(i)}, {1.0f * i, 2.0f, 3.0f}, i % 2 == 0};
+      values[i] = {std::string(i % 70, 'v'), s, std::vector<sample>(i % 3, s)};
+    }
+    const Buffer packed = pack_batch(values, 1);
+
+    // through a pipe, written in uneven pieces and read in chunks smaller than some values
+    int fds[2];
+    assert(::pipe(fds) == 0);
+    std::jthread writer([&] {
+      for (size_t off = 0, n; off < packed.size(); off += n) {
+        n = std::min<size_t>(1 + off % 97, packed.size() - off);
+        if (::write(fds[1], packed.data() + off, n) != static_cast<ssize_t>(n)) std::abort();
+      }
+      ::close(fds[1]);
+    });
+    Error error;
+    std::vector<labeled> read;
+    for (labeled &value : unpack_stream<labeled>(fds[0], error, 64)) read.push_back(std::move(value));
+    writer.join();
+    ::close(fds[0]);
+    assert(read == values && !error);
+
+    // to a file in batches, then decoded from one file and encoded to another as a pipeline
+    const std::string path = "/tmp/mpack_test_" + std::to_string(::getpid()) + ".stream";
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    const int copy_fd = ::open((path + ".copy").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(pack_stream(fd, values, 1000));
+    ::lseek(fd, 0, SEEK_SET);
+    assert(pack_stream(copy_fd, unpack_stream<labeled>(fd, error, 1000)) && !error);
+    assert(std::ranges::equal(MappedFile(path).bytes(), packed) && std::ranges::equal(MappedFile(path + ".copy").bytes(), packed));
+
+    // cut short partway through the string of the last value, then with a byte that is no format at all
+    const size_t last = packed.size() - pack(values.back()).size();
+    assert(::ftruncate(fd, last + 10) == 0);
+    ::lseek(fd, 0, SEEK_SET);
+    read.clear();
+    for (labeled &value : unpack_stream<labeled>(fd, error, 100)) read.push_back(std::move(value));
+    assert(read.size() == values.size() - 1 && error == (Error{Errc::truncated, last}));
+    assert(::ftruncate(fd, last) == 0 && ::lseek(fd, 0, SEEK_END) >= 0 && ::write(fd, "\xc1", 1) == 1);
+    ::lseek(fd, 0, SEEK_SET);
+    size_t count = 0;
+    for ([[maybe_unused]] labeled &value : unpack_stream<labeled>(fd, error)) count++;
+    assert(count == values.size() - 1 && error == (Error{Errc::invalid, last}));
+
+    // a read() that fails, here on a directory, rather than the input ending
+    const int dir_fd = ::open("/tmp", O_RDONLY | O_DIRECTORY);
+    for ([[maybe_unused]] labeled &value : unpack_stream<labeled>(dir_fd, error)) std::abort();
+    assert(error == (Error{Errc::io, 0}));
+    ::close(dir_fd);
+
+    // vec3's define_unpack, which returns out of an aggregate initializer and so would leak the
+    // string it had unpacked if it was cut short, in chunks that split nearly every value
+    std::vector<vec3> vecs(200);
+    for (size_t i = 0; i < vecs.size(); i++) vecs[i] = {i * 0.5f, std::string(20 + i % 40, 'v'), static_cast<uint8_t>(i)};
+    const Buffer packed_vecs = pack_batch(vecs, 1);
+    int vec_fds[2];
+    assert(::pipe(vec_fds) == 0 && ::write(vec_fds[1], packed_vecs.data(), packed_vecs.size()) == static_cast<ssize_t>(packed_vecs.size()));
+    ::close(vec_fds[1]);
+    const ptrdiff_t before = live;
+    {
+      std::vector<vec3> read_vecs;
+      for (vec3 &value : unpack_stream<vec3>(vec_fds[0], error, 7)) read_vecs.push_back(std::move(value));
+      assert(read_vecs == vecs && !error);
+    }
+    assert(live == before);
+    ::close(vec_fds[0]);
+
+    // into a non-blocking pipe that fills up faster than it is drained
+    int slow_fds[2];
+    assert(::pipe(slow_fds) == 0 && ::fcntl(slow_fds[1], F_SETFL, O_NONBLOCK) == 0);
+    Buffer drained;
+    std::jthread drainer([&] {
+      std::byte chunk[4096];
+      for (ssize_t n; (n = ::read(slow_fds[0], chunk, sizeof(chunk))) > 0; ) {
+        drained.insert(drained.end(), chunk, chunk + n);
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    });
+    assert(pack_stream(slow_fds[1], values, 1 << 18));
+    ::close(slow_fds[1]);
+    drainer.join();
+    ::close(slow_fds[0]);
+    assert(std::ranges::equal(drained, packed));
+
+    ::close(fd);
+    ::close(copy_fd);
+    std::remove(path.c_str());
+    std::remove((path + ".copy").c_str());
+  }
+
+  // records patched in place
+  {
+    static_assert(layout<sample>::size == 9 + 5 + 16 + 1);
+    static_assert(layout<sample>::index<&sample::t> == 0 && layout<sample>::index<&sample::ok> == 3);
+    static_assert(layout<sample>::offset<&sample::id> == 9 && layout<sample>::offset<&sample::ok> == 30);
+    static_assert(layout<six>::offset<&six::e> == 3 + 5 + 9 + 1 && layout<six>::offset<&six::f> == 3 + 5 + 9 + 1 + 9);
+    std::vector<sample> samples(3, sample{0.5, {7}, {1.0f, 2.0f, 3.0f}, true});
+    Buffer packed = pack_batch(samples, 1);
+    const std::span<std::byte> second = std::span(packed).subspan(layout<sample>::size, layout<sample>::size);
+    assert(patch<&sample::id>(second, {-70000}) && patch<&sample::t>(second, 2.5) && patch<&sample::xyz>(second, {4.0f, 5.0f, 6.0f}));
+    samples[1] = {2.5, {-70000}, {4.0f, 5.0f, 6.0f}, true};
+    assert(unpack_batch<sample>(packed, 1) == samples && packed == pack_batch(samples, 1));
+
+    // not the layout: a record cut short, and one packed with the id as a plain int
+    assert(!patch<&sample::ok>(std::span(packed).first(30), false));
+    Buffer narrow = pack(0.5, 7, std::array<float, 3>{}, true);
+    assert(unpack<sample>(narrow) && !patch<&sample::id>(std::span(narrow), {8}) && unpack<sample>(narrow)->id.value == 7);
+  }
+
+  // instrumentation, which make check also runs with MPACK_INSTRUMENT_TIMERS defined
+  {
+    using instrument::Family;
+    if constexpr (!instrument::enabled) {
+      pack(std::vector<uint64_t>{1, 2, 3});
+      assert(instrument::snapshot().packed_as(Family::fixint) == 0 && instrument::snapshot().bytes_written == 0);
+    } else {
+      instrument::reset();
+      const std::vector<uint64_t> uints{1, 200, 70000};
+      const std::vector<double> doubles{1.0, 2.0};
+      const Buffer packed = pack(uints, std::string(40, 's'), doubles);
+      instrument::Snapshot counted = instrument::snapshot();
+      assert(counted.packed_as(Family::fixint) == 1 && counted.packed_as(Family::uint_8) == 1 && counted.packed_as(Family::uint_32) == 1);
+      assert(counted.packed_as(Family::str_8) == 1 && counted.packed_as(Family::float_64) == 2 && counted.packed_as(Family::array) == 2);
+      assert(counted.bytes_written == packed.size() && counted.reallocations == 0);
+      assert(counted.pack_calls == instrument::timed && counted.unpack_calls == 0);
+
+      // the vectors and the string each allocate once, and unpacking into them again doesn't
+      std::tuple<std::vector<uint64_t>, std::string, std::vector<double>> values;
+      Unpacker unpacker(packed);
+      assert(unpack_one_into(unpacker, std::get<0>(values)) && unpack_one_into(unpacker, std::get<1>(values)) && unpack_one_into(unpacker, std::get<2>(values)));
+      Unpacker again(packed);
+      assert(unpack_one_into(again, std::get<0>(values)) && unpack_one_into(again, std::get<1>(values)) && unpack_one_into(again, std::get<2>(values)));
+      counted = instrument::snapshot();
+      assert(counted.unpacked_as(Family::uint_32) == 2 && counted.unpacked_as(Family::str_8) == 2 && counted.unpacked_as(Family::float_64) == 4);
+      assert(counted.allocations == 3 && counted.bytes_read == 0);  // until the unpackers go away
+
+      // failures by reason and by how far in: out of range at 0, and truncated at 1, where three elements
+      // no longer fit
+      assert(!unpack<uint8_t>(pack(300)) && !unpack<std::vector<uint64_t>>(BufferView(packed).first(3)));
+      counted = instrument::snapshot();
+      assert(counted.failed_with(Errc::out_of_range) == 1 && counted.failed_with(Errc::truncated) == 1);
+      assert(counted.failure_offsets[0] == 1 && counted.failure_offsets[1] == 1 && counted.unpack_calls == 2 * instrument::timed);
+
+      // packing without reserving first, on another thread, which counts once it has exited too
+      std::jthread([] {
+        Packer packer;
+        for (uint64_t i = 0; i < 1000; i++) pack_one(packer, i);
+        packer.flush();
+      }).join();
+      counted = instrument::snapshot();
+      assert(counted.packed_as(Family::fixint) == 1 + 128 && counted.packed_as(Family::uint_16) == 1 + 1000 - 256);
+      assert(counted.reallocations > 0);
+
+      // a type without define_packed_size() is packed once, not counted first and then packed
+      instrument::reset();
+      pack(vec3{1.25, "727", 0});
+      pack_batch(std::vector<vec3>(10), 4);
+      assert(instrument::snapshot().packed_as(Family::float_32) == 1 + 10 && instrument::snapshot().packed_as(Family::fixstr) == 1 + 10);
+
+      // a big message in many small pieces is skipped over and decoded once, not again with every piece
+      const Buffer big = pack(std::vector<double>(100'000, 0.5), 1u);
+      instrument::reset();
+      StreamUnpacker<std::vector<double>, uint32_t> stream;
+      size_t messages = 0;
+      for (size_t off = 0; off < big.size(); off += 4096) {
+        stream.feed(BufferView(big).subspan(off, std::min<size_t>(4096, big.size() - off)));
+        while (stream.next() == decltype(stream)::Status::ok) messages++;
+      }
+      counted = instrument::snapshot();
+      assert(messages == 1 && counted.bytes_skipped == big.size() && counted.bytes_read == big.size());
+      assert(counted.unpacked_as(Family::float_64) == 100'000 && counted.unpacked_as(Family::array) == 1);
+    }
+    instrument::reset();
+    assert(instrument::snapshot().packed_as(Family::fixint) == 0);
+  }
 
   std::cout << "all tests passed" << std::endl;
 }